@@ -0,0 +1,250 @@
+/*
+throughput and latency benchmark of the fragmentation layer
+
+every combination of the swept parameters is a separate run, a paced fragmentation handler sends
+transfers to a number of peers over a simulated link in manually stepped time, so the results are
+reproducible and do not depend on the speed of the machine, except for the CPU time
+the loopback interface is its own peer, every peer address comes back as the source of the fragments,
+so the data and the responses cross the same channel, each in half of the round trip time
+
+each run prints a single line of JSON to stdout
+- goodput_bps: transfer data delivered per second of the simulated time
+- retransmission_ratio: data fragments sent on top of the ones the transfers consist of, relative to those
+- cpu_ns_per_byte: process CPU time per delivered byte, the simulated interface and channel included
+- latency_ms: percentiles of the time from transmit() to the delivery, queueing included, the p999
+  needs at least 1000 transfers to mean anything
+
+build and run using the run.sh script, the arguments narrow down the sweep, for example
+    ./run.sh --sizes 1024 --loss none,ber --rtt 2 --transfers 1000
+ */
+
+
+#include <libprotoserial/interface.hpp>
+#include <libprotoserial/fragmentation.hpp>
+#include <libprotoserial/testing/simulation.hpp>
+#include <libprotoserial/testing/random.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <algorithm>
+#include <ctime>
+
+using namespace std::chrono_literals;
+
+using handler_base = sp::detail::paced_fragmentation_handler<sp::headers::fragment_16b16b>;
+
+/* counts the data fragments handed over to the interface */
+class benchmark_handler : public handler_base
+{
+    public:
+    using handler_base::handler_base;
+
+    std::uint64_t data_fragments_sent = 0, data_fragments_needed = 0;
+
+    protected:
+    void data_fragment_transmitted(const transfer_handler_type & t, const sp::fragment & f)
+    {
+        handler_base::data_fragment_transmitted(t, f);
+        auto type = sp::parsers::byte_copy<header_type>(f.data().begin()).type();
+        if (type != message_types::FRAGMENT && type != message_types::FRAGMENT_CHECKED)
+            return;
+        ++data_fragments_sent;
+        if (_seen.insert(t.object_id()).second)
+            data_fragments_needed += t.get_fragments_total();
+    }
+
+    private:
+    std::unordered_set<sp::object_id_type> _seen;
+};
+
+struct parameters
+{
+    sp::bytes::size_type transfer_size;
+    uint fragment_size;
+    std::string loss;
+    uint rtt_ms;
+    uint peers;
+    uint concurrency;
+};
+
+struct settings
+{
+    std::vector<uint> sizes = {64, 1024, 16384};
+    std::vector<uint> fragments = {64, 250};
+    std::vector<std::string> losses = {"none", "ber", "burst"};
+    std::vector<uint> rtts = {2, 20};
+    std::vector<uint> peers = {1, 4};
+    std::vector<uint> concurrency = {1, 4};
+    uint transfers = 200;
+    sp::bit_rate::unit_type rate = 1'000'000;
+    uint seed = 1;
+    /* a run that takes longer in the simulated time is cut short */
+    sp::clock::duration limit = 600s;
+    sp::clock::duration step = 100us;
+};
+
+sim::channel::configuration loss_model(const std::string & name)
+{
+    if (name == "ber")
+        return sim::channel::with_ber(1e-5);
+    if (name == "burst")
+        return sim::channel::with_bursts(1e5, 64);
+    return sim::channel::configuration();
+}
+
+/* nearest rank */
+double percentile(std::vector<double> sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    auto rank = static_cast<std::size_t>(p * sorted.size() + 0.999999);
+    return sorted.at(std::clamp<std::size_t>(rank, 1, sorted.size()) - 1);
+}
+
+void run(const parameters & p, const settings & s)
+{
+    sp::manual_clock clock;
+    auto config = loss_model(p.loss);
+    config.delay = std::chrono::duration_cast<sp::clock::duration>(std::chrono::microseconds(p.rtt_ms * 500));
+    config.bandwidth = s.rate;
+    sim::channel ch(config, s.seed);
+    sp::loopback_interface lo(0, 1, 255, 32, p.fragment_size, p.fragment_size * 64, std::ref(ch));
+    benchmark_handler fh(lo);
+    fh.bind_to(lo);
+    std::srand(s.seed);
+
+    /* each peer has up to concurrency transfers going, a new one starts once one of them ends */
+    using key_type = std::pair<sp::interface::address_type, sp::transfer::id_type>;
+    std::map<key_type, sp::clock::time_point> started;
+    std::map<sp::object_id_type, sp::interface::address_type> active;
+    std::vector<uint> free(p.peers, p.concurrency);
+    std::vector<double> latencies;
+    uint issued = 0, ended = 0, failed = 0;
+    std::uint64_t delivered = 0;
+
+    fh.transfer_receive_event.subscribe([&](sp::transfer t){
+        auto itr = started.find(key_type(t.source(), t.get_id()));
+        if (itr == started.end())
+            return;
+        latencies.push_back(std::chrono::duration<double, std::milli>(clock.now() - itr->second).count());
+        delivered += t.data().size();
+        started.erase(itr);
+    });
+    fh.transmit_complete_event.subscribe([&](sp::object_id_type id, sp::fragmentation_handler::transmit_status status){
+        auto itr = active.find(id);
+        if (itr == active.end())
+            return;
+        if (status != sp::fragmentation_handler::transmit_status::DONE)
+            ++failed;
+        ++free.at(itr->second - 2);
+        ++ended;
+        active.erase(itr);
+    });
+
+    auto begin = clock.now();
+    auto cpu_begin = std::clock();
+    while (ended < s.transfers && clock.now() - begin < s.limit)
+    {
+        for (uint peer = 0; peer < p.peers && issued < s.transfers; ++peer)
+        {
+            for (; free.at(peer) > 0 && issued < s.transfers; --free.at(peer), ++issued)
+            {
+                sp::transfer t(lo.interface_id(), peer + 2);
+                t.data() = random_bytes(p.transfer_size);
+                started[key_type(peer + 2, t.get_id())] = clock.now();
+                active[t.object_id()] = peer + 2;
+                fh.transmit(std::move(t));
+            }
+        }
+        clock.advance(s.step);
+        lo.main_task();
+        fh.main_task();
+    }
+    auto cpu = static_cast<double>(std::clock() - cpu_begin) / CLOCKS_PER_SEC;
+    auto duration = std::chrono::duration<double>(clock.now() - begin).count();
+    std::sort(latencies.begin(), latencies.end());
+
+    std::ostringstream out;
+    out << std::setprecision(6)
+        << "{\"transfer_size\":" << p.transfer_size
+        << ",\"fragment_size\":" << p.fragment_size
+        << ",\"loss\":\"" << p.loss << "\""
+        << ",\"rtt_ms\":" << p.rtt_ms
+        << ",\"peers\":" << p.peers
+        << ",\"concurrency\":" << p.concurrency
+        << ",\"transfers\":" << s.transfers
+        << ",\"delivered\":" << latencies.size()
+        << ",\"failed\":" << failed
+        << ",\"completed\":" << (ended == s.transfers ? "true" : "false")
+        << ",\"duration_s\":" << duration
+        << ",\"goodput_bps\":" << (duration > 0 ? delivered * 8 / duration : 0)
+        << ",\"retransmission_ratio\":" << (fh.data_fragments_needed == 0 ? 0 :
+            static_cast<double>(fh.data_fragments_sent - std::min(fh.data_fragments_sent, fh.data_fragments_needed)) / fh.data_fragments_needed)
+        << ",\"cpu_ns_per_byte\":" << (delivered == 0 ? 0 : cpu * 1e9 / delivered)
+        << ",\"latency_ms\":{\"p50\":" << percentile(latencies, 0.5)
+        << ",\"p99\":" << percentile(latencies, 0.99)
+        << ",\"p999\":" << percentile(latencies, 0.999) << "}}";
+    std::cout << out.str() << std::endl;
+}
+
+template<typename T>
+std::vector<T> parse_list(const std::string & arg)
+{
+    std::vector<T> ret;
+    std::istringstream in(arg);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        std::istringstream value(item);
+        T v;
+        value >> v;
+        ret.push_back(v);
+    }
+    return ret;
+}
+
+int main(int argc, char const *argv[])
+{
+    settings s;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string option = argv[i], value = argv[i + 1];
+        if (option == "--sizes")
+            s.sizes = parse_list<uint>(value);
+        else if (option == "--fragments")
+            s.fragments = parse_list<uint>(value);
+        else if (option == "--loss")
+            s.losses = parse_list<std::string>(value);
+        else if (option == "--rtt")
+            s.rtts = parse_list<uint>(value);
+        else if (option == "--peers")
+            s.peers = parse_list<uint>(value);
+        else if (option == "--concurrency")
+            s.concurrency = parse_list<uint>(value);
+        else if (option == "--transfers")
+            s.transfers = std::stoul(value);
+        else if (option == "--rate")
+            s.rate = std::stoull(value);
+        else if (option == "--seed")
+            s.seed = std::stoul(value);
+        else
+        {
+            std::cerr << "unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    for (auto size : s.sizes)
+        for (auto fragment : s.fragments)
+            for (const auto & loss : s.losses)
+                for (auto rtt : s.rtts)
+                    for (auto peers : s.peers)
+                        for (auto concurrency : s.concurrency)
+                            run(parameters{size, fragment, loss, rtt, peers, concurrency}, s);
+    return 0;
+}
@@ -0,0 +1,8 @@
+#!/bin/sh
+
+mkdir -p build &&
+echo "# building the benchmark: " >&2 &&
+cmake -S . -B build -DCMAKE_BUILD_TYPE=Release >&2 &&
+cmake --build build >&2 &&
+echo "# running the benchmark: " >&2 &&
+./build/fragmentation_benchmark "$@"
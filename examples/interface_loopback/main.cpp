@@ -34,15 +34,11 @@ int main(int argc, char const *argv[])
 
     /* a queue of transmitted fragments so we can cross-check them whenever we receive anything */
     std::queue<sp::fragment> transmitted;
-    /* a mutex to prevent a data race between main_task() and transmit() */
-    std::mutex interface_mutex;
-    using lock_guard = std::lock_guard<std::mutex>;
 
 
     /* a convenience lambda function so that we do not have to repeat those two lines everywhere */
     auto transmit = [&](sp::fragment f){
         std::cout << "transmitting: " << f << std::endl;
-        const lock_guard lock(interface_mutex);
         /* store a copy of the fragment in the queue */
         transmitted.push(f);
         /* transmit the original fragment using the loopback interface */
@@ -65,13 +61,17 @@ int main(int argc, char const *argv[])
             std::cout << " does not match: " << orig << std::endl;
     });
 
-    /* launch a thread that calls the main_task() function of the interface in a loop 
+    /* the simulation runs in virtual time, everything happens at the time the scheduler says
+    so there are no threads and no data races, and the result is always the same */
+    sim::scheduler scheduler;
+    auto clock = scheduler.use_as_clock();
+
+    /* call the main_task() function of the interface every millisecond
     we could do this every time we transmit some data, but this brings us closer
     to a real world scenario
     the main_task is where the interface actually processes the received data, 
     so it is continuously checking for newly received bytes */
-    sim::loop_thread main_thread([&](){
-        const lock_guard lock(interface_mutex);
+    scheduler.every(1ms, [&](){
         interface.main_task();
     });
 
@@ -81,8 +81,8 @@ int main(int argc, char const *argv[])
     std::cout << "hello world:" << std::endl;
     transmit(sp::fragment(3, sp::bytes("hello world")));
     
-    /* wait for a tiny bit so we get a nice print */
-    std::this_thread::sleep_for(10ms);
+    /* let it run for a tiny bit so we get a nice print */
+    scheduler.run_for(10ms);
 
     std::cout << "more fragments at once:" << std::endl;
     /* transmit 1, 2, 3 to 42 */
@@ -91,8 +91,12 @@ int main(int argc, char const *argv[])
     transmit(sp::fragment(42, random_bytes(5)));
 
 
-    /* block until we have received everything */
-    while(!transmitted.empty());
+    /* run until we have received everything */
+    if (!scheduler.run_until([&](){return transmitted.empty();}, 1s))
+    {
+        std::cout << "some fragments did not arrive" << std::endl;
+        return 1;
+    }
 
     return 0;
 }
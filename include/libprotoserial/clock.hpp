@@ -29,6 +29,8 @@
 #else
 #include <chrono>
 #include <cstdint>
+#include <functional>
+#include <atomic>
 #endif
 
 namespace sp
@@ -62,7 +64,98 @@ namespace sp
 
 #else
 
-    using clock = std::chrono::high_resolution_clock;
+    /* the host clock, it reads the high_resolution_clock unless a different source is set, this is 
+    how the whole stack can run in virtual time (sim::scheduler) or in manually stepped time (manual_clock) */
+    struct clock
+    {
+        using system     = std::chrono::high_resolution_clock;
+        using rep        = system::rep;
+        using period     = system::period;
+        using duration   = std::chrono::duration<rep, period>;
+        using time_point = std::chrono::time_point<clock>;
+        static constexpr bool is_steady = false;
+
+        /* returns the current time, an empty source means the system clock */
+        using source_type = std::function<time_point(void)>;
+
+        static time_point now() noexcept
+        {
+            if (_source)
+                return _source();
+            return time_point{std::chrono::duration_cast<duration>(system::now().time_since_epoch())};
+        }
+
+        /* replaces the time source, returns the previous one so that it can be restored */
+        static source_type set_source(source_type source)
+        {
+            std::swap(_source, source);
+            return source;
+        }
+
+        private:
+        inline static source_type _source;
+    };
+
+#endif
+
+    /* coarse time captured once at the start of every main_task, the hot paths (fragment and transfer 
+    timestamps, holdoff checks) use it instead of reading the clock each time. it lags behind 
+    clock::now() by at most one main_task period, use clock::now() where precision matters and 
+    outside of the main_task (transfers created by the user) */
+    struct coarse_clock
+    {
+        using duration   = clock::duration;
+        using time_point = clock::time_point;
+
+        static time_point now() noexcept {return _now;}
+        /* called by the main_task functions, returns the new time */
+        static time_point update() noexcept {return _now = clock::now();}
+
+        private:
+#if defined(SP_STM32) || defined(SP_STM32ZST)
+        inline static time_point _now = clock::now();
+#else
+        /* shared by all the handlers and interfaces, their main_tasks may run on different threads */
+        inline static std::atomic<time_point> _now = clock::now();
+#endif
+    };
+
+#if !defined(SP_STM32) && !defined(SP_STM32ZST)
+
+    /* sets the clock source for as long as it exists, the previous source gets restored */
+    class clock_override
+    {
+        clock::source_type _previous;
+
+        public:
+        clock_override(clock::source_type source) :
+            _previous(clock::set_source(std::move(source))) {coarse_clock::update();}
+        ~clock_override() 
+        {
+            clock::set_source(std::move(_previous));
+            coarse_clock::update();
+        }
+
+        clock_override(const clock_override &) = delete;
+        clock_override & operator=(const clock_override &) = delete;
+    };
+
+    /* clock source that only moves when told to, it becomes the sp::clock source for its lifetime */
+    class manual_clock
+    {
+        clock::time_point _now;
+        clock_override _override;
+
+        public:
+        /* starts one second after the epoch so that it does not collide with never() */
+        manual_clock() : 
+            _now(clock::time_point{std::chrono::seconds(1)}), _override([this](){return _now;}) {}
+
+        clock::time_point now() const {return _now;}
+        /* the coarse_clock follows right away, as if a main_task was run */
+        void advance(clock::duration d) {_now += d; coarse_clock::update();}
+        void set(clock::time_point t) {_now = t; coarse_clock::update();}
+    };
 
 #endif
 
@@ -99,6 +99,21 @@ namespace sp
             std::copy(begin, end, std::back_inserter(*this));
         }
 
+        /* wraps memory owned by someone else, the container never frees it, instead it holds owner which has to 
+        keep the memory alive, front and back is the usable capacity around the data. push_front() and push_back()
+        write into that capacity, any operation that needs to reallocate detaches the container from the memory.
+        the owner expects the data to stay as it was, whoever modifies the data in place must call detach() first */
+        static bytes view(std::shared_ptr<void> owner, pointer base, size_type front, size_type length, size_type back)
+        {
+            bytes ret;
+            ret._data = base;
+            ret._offset = front;
+            ret._length = length;
+            ret._capacity = front + length + back;
+            ret._owner = std::move(owner);
+            return ret;
+        }
+
         bytes(const std::string & from) :
             bytes(from.size())
         {
@@ -114,7 +129,7 @@ namespace sp
         bytes & operator= (const bytes & other)
         {
             _offset = 0;
-            if (other.size() != _capacity) 
+            if (other.size() != _capacity || is_view()) 
             {
                 clear();
                 alloc(other.size());
@@ -124,26 +139,28 @@ namespace sp
             return *this;
         }
         /* move */
-        constexpr bytes(bytes && other)
+        bytes(bytes && other)
         {
             _data = other.get_base();
             _length = other.size();
             _offset = other.capacity_front();
             _capacity = other.capacity();
+            _owner = std::move(other._owner);
             other._init();
         }
-        constexpr bytes & operator= (bytes && other)
+        bytes & operator= (bytes && other)
         {
             clear();
             _data = other.get_base();
             _length = other.size();
             _offset = other.capacity_front();
             _capacity = other.capacity();
+            _owner = std::move(other._owner);
             other._init();
             return *this;
         }
 
-        constexpr ~bytes()
+        ~bytes()
         {
             clear();
         }
@@ -193,7 +210,7 @@ namespace sp
         
         /* expands the container by the requested amount such that [front B][size B][back B], 
         front or back can be 0, in which case nothing happens */
-        constexpr void expand(const size_type front, const size_type back)
+        void expand(const size_type front, const size_type back)
         {
             reserve(front, back);
             _offset = _offset - front;
@@ -201,7 +218,7 @@ namespace sp
         }
         /* capacity of the container will be equal or greater than size() + front + back, size() does not change,
         this function merely reserves requested capacity by reallocation if necesary, front or back can be 0 */
-        constexpr void reserve(const size_type front, const size_type back)
+        void reserve(const size_type front, const size_type back)
         {
             using traits_t = std::allocator_traits<allocator_type>;
 
@@ -223,15 +240,18 @@ namespace sp
                 for (size_type i = 0; i < _length; i++)
                     _data[i + front] = old_data[i + _offset];
 
-                traits_t::deallocate(_alloc, old_data, old_capacity);
+                if (!is_view())
+                    traits_t::deallocate(_alloc, old_data, old_capacity);
             }
+            /* the data is ours now */
+            _owner.reset();
 
             /* finally update the offset because we no longer need the old value */
             _offset = front;
         }
         /* shrink the container from either side, this does not reallocate the data, just hides it
         use the shrink_to_fit function after this one to actually reduce the container size */
-        constexpr void shrink(const size_type front, const size_type back)
+        void shrink(const size_type front, const size_type back)
         {
             /* do nothing */
             if (front == 0 && back == 0)
@@ -251,42 +271,45 @@ namespace sp
                 if (back > 0)
                 {
                     /* zero out the newly hidden back and shrink the _length
-                    this must be done before the front, otherwise the set would be offset */
-                    set(_length - back, back, (value_type)0);
+                    this must be done before the front, otherwise the set would be offset,
+                    the bytes behind a view belong to its owner and are left alone */
+                    if (!is_view())
+                        set(_length - back, back, (value_type)0);
                     _length -= back;
                 }
                 if (front > 0)
                 {
                     /* zero out the newly hidden front, move the _offset and shrink _length */
-                    set(0, front, (value_type)0);
+                    if (!is_view())
+                        set(0, front, (value_type)0);
                     _offset += front;
                     _length -= front;
                 }
             }
         }
         /* expand the container by other.size() bytes and copy other's contents into that space */
-        constexpr void push_front(const bytes & other)
+        void push_front(const bytes & other)
         {            
             expand(other.size(), 0);
             std::copy(other.begin(), other.end(), begin());
         }
-        constexpr void push_front(const value_type b)
+        void push_front(const value_type b)
         {
             expand(1, 0);
             at(0) = b;
         }
         /* expand the container by other.size() bytes and copy other's contents into that space */
-        constexpr void push_back(const bytes & other)
+        void push_back(const bytes & other)
         {
             expand(0, other.size());
             std::copy(other.begin(), other.end(), end() - other.size());
         }
-        constexpr void push_back(const value_type & b)
+        void push_back(const value_type & b)
         {
             expand(0, 1);
             at(size() - 1) = b;
         }
-        constexpr void push_back(const value_type && b)
+        void push_back(const value_type && b)
         {
             expand(0, 1);
             at(size() - 1) = b;
@@ -317,11 +340,13 @@ namespace sp
         }
         /* safe to call multiple times, frees the resources for the HEAP type and sets up the
         container as if it was just initialized using the default constructor */
-        constexpr void clear()
+        void clear()
         {
             using traits_t = std::allocator_traits<allocator_type>;
 
-            if (_data && _capacity != 0)
+            if (is_view())
+                _owner.reset();
+            else if (_data && _capacity != 0)
                 traits_t::deallocate(_alloc, _data, _capacity);
             
             _init();
@@ -329,8 +354,10 @@ namespace sp
         /* releases the internally stored data buffer, use the capacity_front function before calling
         this one in case capacity != size to obtain the the offset index, which indicates the 
         length of preallocated front */
-        constexpr pointer release()
+        pointer release()
         {
+            /* the memory of a view is not ours to give away, make a copy which is */
+            detach();
             pointer ret = _data;
             _init();
             return ret;
@@ -350,6 +377,19 @@ namespace sp
         constexpr size_type capacity_back() const {return _capacity - _offset - _length;}
         /* returns pointer to the beggining of the data */
         constexpr pointer get_base() const {return _data;}
+        /* true if the memory is owned by someone else, see view() */
+        bool is_view() const {return static_cast<bool>(_owner);}
+        /* turns a view into a container which owns a copy of the memory, the capacity is preserved */
+        void detach()
+        {
+            if (!is_view())
+                return;
+
+            pointer old_data = _data;
+            alloc(_capacity);
+            std::copy(old_data + _offset, old_data + _offset + _length, _data + _offset);
+            _owner.reset();
+        }
 
 
         
@@ -357,6 +397,8 @@ namespace sp
         pointer _data;
         size_type _length, _capacity, _offset;
         allocator_type _alloc;
+        /* keeps the memory of a view alive, empty for containers which own their memory */
+        std::shared_ptr<void> _owner;
 
         constexpr inline void range_check(size_type i) const
         {
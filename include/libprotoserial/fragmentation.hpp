@@ -27,6 +27,7 @@
 #include <libprotoserial/fragmentation/fragmentation.hpp>
 #include <libprotoserial/fragmentation/bypass_handler.hpp>
 #include <libprotoserial/fragmentation/base_handler.hpp>
+#include <libprotoserial/fragmentation/paced_handler.hpp>
 
 
 namespace sp
@@ -35,6 +36,17 @@ namespace sp
     {
         using detail::bypass_fragmentation_handler::bypass_fragmentation_handler;
     };
+
+    class paced_fragmentation_handler : public detail::paced_fragmentation_handler<headers::fragment_8b8b>
+    {
+        using detail::paced_fragmentation_handler<headers::fragment_8b8b>::paced_fragmentation_handler;
+    };
+
+    /* for transfers of more than 255 fragments and high transfer rates */
+    class paced_fragmentation_handler_16b16b : public detail::paced_fragmentation_handler<headers::fragment_16b16b>
+    {
+        using detail::paced_fragmentation_handler<headers::fragment_16b16b>::paced_fragmentation_handler;
+    };
 }
 
 
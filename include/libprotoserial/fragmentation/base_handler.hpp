@@ -24,33 +24,301 @@
 #define _SP_FRAGMENTATION_BASEHANDLER
 
 #include <list>
-#include <functional>
+#include <deque>
+#include <optional>
+#include <algorithm>
+#include <limits>
 
 #include "libprotoserial/fragmentation/fragmentation.hpp"
 #include "libprotoserial/fragmentation/transfer_handler.hpp"
+#include "libprotoserial/fragmentation/rtt_estimator.hpp"
+#include "libprotoserial/fragmentation/transfer_table.hpp"
+#include "libprotoserial/fragmentation/completed_cache.hpp"
+#include "libprotoserial/fragmentation/transfer_scheduler.hpp"
 
 
 namespace sp
 {
 namespace detail
 {
-    //template<class Header>
+    /* Header is the fragmentation header, its index_type and id_type limit the size of a transfer 
+    and the number of transfer IDs in circulation, see headers::fragment_header */
+    template<class Header>
     class base_fragmentation_handler : public fragmentation_handler
     {
         public:
-        using Header = headers::fragment_8b8b;
+        using header_type = Header;
         using message_types = typename Header::message_types;
-        using fragmentation_handler::fragmentation_handler;
+        using status_type = headers::fragment_status;
+
+        /* what happens to a new transfer that does not fit into the budget of its direction */
+        enum class admission_policy
+        {
+            /* the outgoing transfer ends with transmit_status::BUSY, the fragment which would start the 
+            incoming one is dropped and our status tells the peers to back off until there is room */
+            REJECT,
+            /* the transfer which did not hear from its peer for the longest time, at least stall_time, 
+            makes room, an evicted outgoing transfer ends with transmit_status::BUSY, REJECT without one */
+            EVICT_STALLED,
+            /* the outgoing transfer waits until there is room, the waiting ones start in the order they came in, 
+            up to the budget's worth of transfers wait, the rest is REJECTed as are the incoming transfers 
+            since their peers retransmit anyway */
+            DEFER,
+        };
+
+        /* limits the transfers held in one direction, 0 means no limit, an incoming transfer counts 
+        with its reassembly buffer (bounded by the window when streamed), an outgoing one with its data */
+        struct transfer_budget
+        {
+            bytes::size_type size = 0;
+            size_type count = 0;
+            admission_policy policy = admission_policy::REJECT;
+        };
+
+        struct configuration
+        {
+            /* thresholds of the interface receive buffer level (interface::status.receive_buffer_level) 
+            in bytes, these influence our_status(), frb_poor is the threshold where the status returns 
+            rx_poor() == true, frb_critical is when it returns rx_critical() == true */
+            bytes::size_type frb_poor, frb_critical;
+            /* for how long should we hold off data fragments targeted at a peer that reported rx_poor(),
+            it triples for rx_critical() */
+            clock::duration pressure_holdoff;
+            /* maximum number of unacknowledged data fragments of a single transfer, it gets reduced 
+            when the peer reports receive pressure */
+            index_type window_size;
+            /* the retransmit timeout is estimated from the round trip time of each peer (see rtt_estimator), 
+            initial_rto is used until the first measurement is taken, it should be on the safe side since the 
+            timeout doubles with every expiration anyway, the estimate is kept within [min_rto, max_rto] */
+            clock::duration initial_rto, min_rto, max_rto;
+            /* the outgoing transfer is considered UNREACHABLE after this many retransmit timeouts in a row */
+            uint max_retries;
+            /* delivered incoming transfers are remembered in order to detect spurious retransmits that may 
+            happen due to fragment delays and lost ACKs, for as long as the peer may be retransmitting, but at 
+            least this long */
+            clock::duration minimum_incoming_hold_time;
+            /* at most this many delivered transfers are remembered, the oldest ones are forgotten first, 
+            it is kept below half of the Header's transfer ID space, a peer reuses its IDs after that and 
+            the new transfer would be taken for a retransmit of the remembered one */
+            size_type completed_cache_size;
+            /* the share of the link each transfer priority class gets relative to the others, 
+            see transfer_scheduler */
+            transfer_scheduler::weights_type priority_weights;
+            /* the response to received fragments waits up to ack_delay or ack_every fragments so that it 
+            covers more of them and can be sent along with other messages to the peer, ack_every should 
+            be well below the peer's window_size and ack_delay below its min_rto */
+            clock::duration ack_delay;
+            index_type ack_every;
+            /* forward error correction, a FRAGMENT_PARITY follows every fec_block data fragments (see 
+            transfer_handler), 0 disables it, this can be overridden per peer (see set_peer_fec_block())
+            with fec_adaptive, the block size follows the loss rate we observe towards the peer instead, 
+            fec_block is used until there is enough traffic to tell, parity is sent once the loss rate 
+            exceeds fec_loss_threshold, the more frequently the higher the rate but at most every 
+            fec_max_block fragments */
+            index_type fec_block;
+            bool fec_adaptive;
+            double fec_loss_threshold;
+            index_type fec_max_block;
+            /* incoming transfers of at least this many bytes are handed over through transfer_chunk_event 
+            as they arrive instead of being reconstructed in memory, provided that someone subscribed to it, 
+            0 disables the streaming */
+            bytes::size_type stream_threshold;
+            /* the outgoing transfers carry a checksum the peer verifies before it acknowledges the transfer 
+            (see transfer_checksum), when it does not match the peer asks for window_size fragments at a time 
+            again until it does, the incoming transfers are verified whenever they carry one */
+            bool checksum_transfers;
+            /* protect the memory from a burst of transfers, see transfer_budget, a transfer is stalled 
+            once nothing came from its peer regarding it for stall_time */
+            transfer_budget incoming_budget, outgoing_budget;
+            clock::duration stall_time;
+
+            /* this tries to set good default values */
+            configuration(const interface & i)
+            {
+                /* the peer should slow down once there is a fragment's worth of unprocessed data in our
+                receive buffer, interfaces that do not report the receive buffer never signal pressure */
+                auto size = i.get_status().receive_buffer_size;
+                frb_poor = std::min(size / 2, i.max_data_size() + i.minimum_prealloc().front() + i.minimum_prealloc().back());
+                frb_critical = std::min(size - size / 4, frb_poor * 3);
+                pressure_holdoff = std::chrono::milliseconds(5);
+                window_size = 8;
+                /* as recommended by RFC 6298, the minimum is lower since there are no delayed ACKs */
+                initial_rto = std::chrono::seconds(1);
+                min_rto = std::chrono::milliseconds(10);
+                max_rto = std::chrono::seconds(10);
+                max_retries = 5;
+                minimum_incoming_hold_time = std::chrono::milliseconds(100);
+                completed_cache_size = 64;
+                /* a control transfer is served 4 times as often as a normal one, which gets 4 times 
+                the share of bulk data */
+                priority_weights = {1, 4, 16, 64};
+                ack_delay = std::chrono::milliseconds(2);
+                ack_every = window_size / 2;
+                fec_block = 0;
+                fec_adaptive = false;
+                fec_loss_threshold = 0.02;
+                fec_max_block = 16;
+                stream_threshold = 0;
+                checksum_transfers = false;
+                stall_time = std::chrono::seconds(1);
+            }
+        };
+
+        base_fragmentation_handler(interface & i, prealloc_size prealloc, configuration c) :
+            fragmentation_handler(i, prealloc), _config(c), 
+            _completed(std::min<size_type>(c.completed_cache_size, std::numeric_limits<typename Header::id_type>::max() / 2)), 
+            _scheduler(c.priority_weights)
+        {
+            /* the transfer IDs issued for the interface must fit into our Header */
+            global_id_factory.set_max_id(i.interface_id(), std::numeric_limits<typename Header::id_type>::max());
+        }
+
+        base_fragmentation_handler(interface & i, prealloc_size prealloc) :
+            base_fragmentation_handler(i, prealloc, configuration(i)) {}
+
+        base_fragmentation_handler(interface & i) :
+            base_fragmentation_handler(i, i.minimum_prealloc()) {}
+
+        /* the receiver status we advertise in every outgoing header, it is derived from the load of our interface, 
+        it is critical while we reject incoming transfers for the lack of room */
+        status_type our_status() const
+        {
+            if (_incoming_busy)
+                return status_type(status_type::RX_CRITICAL);
+            return status_type(_interface.get_status(), _config.frb_poor, _config.frb_critical);
+        }
+
+        /* the total footprint and the number of the transfers held in one direction, see transfer_budget */
+        struct budget_usage
+        {
+            bytes::size_type size = 0;
+            size_type count = 0;
+        };
+
+        inline const budget_usage & get_budget_usage(bool incoming) const
+        {
+            return incoming ? _incoming_usage : _outgoing_usage;
+        }
+
+        /* the number of outgoing transfers waiting for room, see admission_policy::DEFER */
+        inline size_type get_deferred_count() const
+        {
+            return _deferred.size();
+        }
+
+        /* the current retransmit timeout towards the peer */
+        clock::duration retransmit_timeout(address_type addr) const
+        {
+            auto peer = find_peer(addr);
+            return peer != _peers.end() ? peer->rtt.rto() : new_estimator().rto();
+        }
+
+        /* the round trip time estimator of the peer, nullptr if we have not communicated with it yet */
+        const rtt_estimator * peer_rtt(address_type addr) const
+        {
+            auto peer = find_peer(addr);
+            return peer != _peers.end() ? &peer->rtt : nullptr;
+        }
+
+        /* the number of data fragments per FRAGMENT_PARITY the transfers to the peer get, 0 for none */
+        index_type fec_block(address_type addr) const
+        {
+            auto peer = find_peer(addr);
+            if (peer == _peers.end())
+                return _config.fec_block;
+            if (peer->fec_block)
+                return *peer->fec_block;
+            if (!_config.fec_adaptive || peer->fragments_sent < min_loss_samples)
+                return _config.fec_block;
+
+            /* roughly one loss per four blocks, a block with a single loss is rebuilt */
+            auto loss = peer->loss_rate();
+            if (loss < _config.fec_loss_threshold)
+                return 0;
+            return std::clamp<index_type>(static_cast<index_type>(1.0 / (4.0 * loss)), 2, std::max<index_type>(_config.fec_max_block, 2));
+        }
+
+        /* fixes the FEC block size of the peer, see configuration::fec_block, nullopt reverts to the configuration */
+        void set_peer_fec_block(address_type addr, std::optional<index_type> block)
+        {
+            get_peer(addr).fec_block = block;
+        }
+
+        /* the share of the data fragments to the peer that had to be retransmitted recently, the fragments 
+        rebuilt by the peer from the parity do not count since we do not learn about them */
+        double peer_loss_rate(address_type addr) const
+        {
+            auto peer = find_peer(addr);
+            return peer != _peers.end() ? peer->loss_rate() : 0;
+        }
+
+        /* true while we refrain from transmitting data fragments to this peer because it reported 
+        that its receive buffer is filling up */
+        bool is_peer_in_holdoff(address_type addr, clock::time_point now = clock::now()) const
+        {
+            auto peer = find_peer(addr);
+            return peer != _peers.end() && peer->in_transmit_holdoff(now);
+        }
 
         protected:
 
+        /* information we hold about each peer we have communicated with */
+        struct peer_state
+        {
+            peer_state(address_type a, rtt_estimator e) :
+                addr(a), tx_holdoff(never()), rtt(e) {}
+
+            address_type addr;
+            /* the last status this peer advertised */
+            status_type status;
+            /* from our point of view, data fragments are not sent to this peer until then */
+            clock::time_point tx_holdoff;
+            /* measured from our outgoing transfers, drives the timeouts of transfers in both directions */
+            rtt_estimator rtt;
+            /* overrides configuration::fec_block */
+            std::optional<index_type> fec_block;
+            /* data fragments sent to the peer and the retransmits of them, both are halved now and then 
+            so that the loss rate follows the current state of the link */
+            uint fragments_sent = 0, fragments_lost = 0;
+
+            double loss_rate() const {return fragments_sent == 0 ? 0 : std::min(1.0, static_cast<double>(fragments_lost) / fragments_sent);}
+
+            bool in_transmit_holdoff(clock::time_point now) const {return tx_holdoff > now;}
+        };
+
+        /* the loss rate is not trusted until this many fragments were sent, and it forgets the older 
+        ones once there are max_loss_samples of them */
+        static constexpr uint min_loss_samples = 32, max_loss_samples = 512;
+
         using transfer_handler_type = transfer_handler<Header>;
-        using transfer_list_type = std::list<transfer_handler_type>;
+        using transfer_list_type = transfer_table<transfer_handler_type>;
+        using peer_list_type = std::list<peer_state>;
 
         transfer_list_type transfers;
+        peer_list_type _peers;
+        configuration _config;
+        completed_transfer_cache _completed;
+        transfer_scheduler _scheduler;
+
+        /* FRAGMENT_ACKs waiting to be sent to a peer, see queue_ack() */
+        struct ack_batch
+        {
+            fragment_metadata metadata;
+            bytes headers;
+        };
+        std::vector<ack_batch> _ack_batches;
+        /* peers which are due a response from us, the transfer_key of their incoming transfers without 
+        the id, only used within do_main() */
+        std::vector<transfer_key> _due_peers;
+        /* see transfer_budget, the deferred outgoing transfers count against _deferred_usage only */
+        budget_usage _incoming_usage, _outgoing_usage, _deferred_usage;
+        std::deque<transfer> _deferred;
+        /* an incoming transfer was rejected, it is cleared once one of them goes away */
+        bool _incoming_busy = false;
 
         
-        /* calculate priority score of the transfer, transfer with highest score is selected for transmit */
+        /* calculate priority score of the transfer, transfer_scheduler picks the flow (peer and priority class) 
+        to transmit next, within it the ready transfer with the highest score is selected for transmit */
         virtual int transfer_transmit_priority(const transfer_handler_type &) = 0;
         /* this function is usually called before transfer_transmit_priority(), it disqualifies transfers
         targeted at peers that risk overload */
@@ -62,142 +330,253 @@ namespace detail
         virtual bool is_fragment_transmit_allowed() = 0;
         /* this function is called when a response to bordering fragment of the transfer was received */
         virtual void bordering_fragment_response_received(const transfer_handler_type &, message_types) = 0;
+        /* the peer acknowledged new fragments of the outgoing transfer */
+        virtual void transfer_progressed(const transfer_handler_type &) {}
+        /* fragments of the outgoing transfer were lost, either the peer asked for them or the retransmit 
+        timeout expired */
+        virtual void transfer_loss_detected(const transfer_handler_type &) {}
+        /* a data fragment of the outgoing transfer was handed over to the interface */
+        virtual void data_fragment_transmitted(const transfer_handler_type &, const fragment &) {}
 
 
         /* implementation of fragmentation_handler::do_receive */
         /* the callback handles the incoming fragments, it does not handle any timeouts, sending requests, 
-        sending responses in general or anything that assumes periodicity, the main_task is for that */
+        sending responses in general or anything that assumes periodicity, the main_task is for that 
+        a FRAGMENT_ACK carries no data of its own, whatever follows it in the fragment is another message, 
+        so a fragment holds any number of ACKs followed by at most one other message (see queue_ack()) */
         void do_receive(fragment f)
         {
 #ifdef SP_FRAGMENTATION_DEBUG
             std::cout << "receive got: " << f << std::endl;
 #endif
-            if (f && f.data().size() >= sizeof(Header))
+            while (f && f.data().size() >= sizeof(Header))
             {
                 /* copy the header from the fragment data after some obvious sanity checks */
                 auto h = parsers::byte_copy<Header>(f.data().begin());
-                if (h.is_valid())
+                if (!h.is_valid())
+                    return;
+                
+                /* discard the header from fragment's data since we have it parsed out */
+                f.data().shrink(sizeof(Header), 0);
+
+                /* every header carries the receiver status of the peer, act on it */
+                peer_status_received(f.source(), h.get_status());
+
+                switch (h.type())
                 {
-                    /* discard the header from fragment's data since we have it parsed out */
-                    f.data().shrink(sizeof(Header), 0);
+                case message_types::FRAGMENT:
+                case message_types::FRAGMENT_CHECKED:
+                    receive_data_fragment(std::move(f), h);
+                    return;
+                case message_types::FRAGMENT_ACK:
+                    receive_ack_fragment(f, h);
+                    break;
+                case message_types::FRAGMENT_REQ:
+                    receive_request_fragment(f, h);
+                    return;
+                case message_types::FRAGMENT_NACK:
+                    receive_nack_fragment(f, h);
+                    return;
+                case message_types::FRAGMENT_PARITY:
+                    receive_parity_fragment(f, h);
+                    return;
+                case message_types::FRAGMENT_RESEND:
+                    receive_resend_fragment(f, h);
+                    return;
+                default:
+                    /* unknown header message_type, ignore */
+                    return;
+                }
+            }
+        }
 
-                    /* handle the reception of user fragments and their ordering */
-                    //TODO break up using a switch and separate into functions 
-                    if (h.type() == message_types::FRAGMENT)
-                    {
-                        if (f.data().size() > 0)
-                        {
-                            /* branch for handling incoming transfers */
-                            /* check if we already know that incoming transfer ID */
-                            auto itr = find_transfer([&f, &h](const auto & tr){return tr.is_incoming() && tr.is_part_of(f, h);});
-                            if (itr != transfers.end())
-                            {
-                                /* we know this ID, now we need to check if we have already received this transfer and
-                                is therefor duplicate, or whether we are in the process of receiving it */
-                                //TODO we need a way to remember already completed incoming transfers for some time to cover this
-//                            if (it->has_data())
-//                            {
+        void receive_data_fragment(fragment f, const Header & h)
+        {
+            /* check if we already know that incoming transfer ID */
+            auto itr = find_transfer(f, h, true);
+            auto completed = _completed.find(transfer_key{f.interface_id(), f.source(), h.get_id(), true}, coarse_clock::now());
+            if (itr != transfers.end() && itr->is_part_of(f, h))
+            {
 #ifdef SP_FRAGMENTATION_DEBUG
-                                    std::cout << "assigning to existing incoming transfer id " << (int)h.get_id() << " at " << (int)h.fragment() << " of " << (int)h.fragments_total() << std::endl;
+                std::cout << "assigning to existing incoming transfer id " << (int)h.get_id() << " at " << (int)h.fragment() << " of " << (int)h.fragments_total() << std::endl;
 #endif
-                                    /* the ID is in known transfers, we need to add the incoming fragment to it */
-                                    itr->put_fragment(h.fragment(), f);
-                                    //TODO if we receive the first fragment multiple times, we were slow to ACK it, the ACK got lost or the source is too fast
-//                            }
-//                            else
-//                            {
-//                                /* we, for some reason, received a fragment of already received transfer, the ACK
-//                                from us probably got lost in transit, just reply with another ACK and ignore this fragment */
-//#ifdef SP_FRAGMENTATION_WARNING
-//                                std::cout << "sending ACK for already received id " << (int)h.get_id() << std::endl;
-//#endif
-//                                transmit_event.emit(std::move(fragment(p.source(), 
-//                                    std::move(to_bytes(make_header(types::FRAGMENT_ACK, h)))
-//                                )));
-//                            }
-                            }
-                            else
-                            {
+                itr->put_fragment(h.fragment(), f);
+            }
+            else if (completed && completed->fragments_total == h.fragments_total() && completed->prev_id == h.get_prev_id())
+            {
 #ifdef SP_FRAGMENTATION_DEBUG
-                                std::cout << "creating new incoming transfer id " << (int)h.get_id() << std::endl;
+                std::cout << "acknowledging already delivered transfer id " << (int)h.get_id() << std::endl;
 #endif
-                                /* we don't know this transfer ID, attempt to create new incoming transfer.
-                                we should always receive the first fragment of a transfer first, because we need to ACK
-                                it before the transfer can continue */
-                                //TODO limit the number of stored transfers
-                                if (h.fragment() == 1)
-                                {
-                                    transfers.emplace_back(std::move(f), h);
-                                }
-                            }
-                        }
-                    }
-                    else if (h.type() == message_types::FRAGMENT_REQ)
-                    {
+                /* duplicates of already delivered transfers only get acknowledged again, the ACK 
+                from us probably got lost in transit */
+                _completed.insert(completed->key, completed->destination, completed->fragments_total, 
+                    completed->prev_id, completed_expiry(f.source()));
+                return;
+            }
+            else if (transfer_handler_type::can_start_with(f, h))
+            {
+#ifdef SP_FRAGMENTATION_DEBUG
+                std::cout << "creating new incoming transfer id " << (int)h.get_id() << std::endl;
+#endif
+                /* we don't know this transfer ID, the fragments can come in any order, the last one of 
+                a multi fragment transfer is the exception since we cannot infer the fragment size from it */
+                auto stream = is_streamed(f, h);
+                auto size = footprint(h.fragments_total(), f.data().size(), stream);
+                if (!admit(true, size))
+                {
 #ifdef SP_FRAGMENTATION_WARNING
-                        std::cout << "handling retransmit request of id " << (int)h.get_id() << " fragment " << (int)h.fragment() << " of " << (int)h.fragments_total() << std::endl;
+                    std::cout << "no room for incoming transfer id " << (int)h.get_id() << std::endl;
 #endif
-                        auto itr = find_transfer([&f, &h](const auto & tr){return tr.is_outgoing() && tr.is_request_of(f, h);});
-                        if (itr != transfers.end())
-                        {
-                            /* store the measurement of the round trip time */
-                            if (itr->is_current_bordering())
-                                bordering_fragment_response_received(*itr, h.type());
-
-                            /* when we get a retransmit request, we should queue it and actually handle it in 
-                            the main task, where we also decide what has the highest priority,
-                            this information can be stored in the transfer_handler using existing variables, 
-                            since we only need one fragment of the transfer to be retransmitted */
-                            if (itr->retransmit_request(h.fragment()))
-                            {
-                                //TODO retransmit set
-                            }
-                            else
-                            {
-                                //TODO retransmit set failed, request does not make sense
-                            }
-                        }
-                        else
-                        {
-                            //TODO got retransmit request for a transfer we no longer have
-                        }
-                    }
-                    else if (h.type() == message_types::FRAGMENT_ACK)
-                    {
+                    /* the peer can only back off when there is a chance that the room frees up */
+                    if (_config.incoming_budget.size == 0 || size <= _config.incoming_budget.size)
+                        _incoming_busy = true;
+                    return;
+                }
+                itr = transfers.emplace(std::move(f), h, stream, _config.window_size);
+                itr->set_resend_block(_config.window_size);
+                account(*itr, true);
+            }
+            else
+                return;
+
+            deliver_if_complete(itr);
+        }
+
+        void receive_parity_fragment(const fragment & f, const Header & h)
+        {
 #ifdef SP_FRAGMENTATION_DEBUG
-                        std::cout << "got fragment ACK for id " << (int)h.get_id() << std::endl;
+            std::cout << "got parity for id " << (int)h.get_id() << " from " << (int)h.fragment() << std::endl;
 #endif
-                        auto itr = find_transfer([&f, &h](const auto & tr){return tr.is_outgoing() && tr.is_ack_of(f, h);});
-                        if (itr != transfers.end())
-                        {
-                            /* store the measurement of the round trip time */
-                            if (itr->is_current_bordering())
-                                bordering_fragment_response_received(*itr, h.type());
-
-                            /* emit the ACK event for the sender and destroy this outgoing transfer
-                            since we've done our job and don't need it anymore - in contrast to the 
-                            incoming transfer where the transmitted ACK may not be received, here we
-                            can be sure because if we receive another ACK for some reason, we'll 
-                            just ignore it since we no longer store that transfer */
-                            transmit_complete_event.emit(itr->object_id(), transmit_status::DONE);
-                            transfers.erase(itr);
-                        }
-                        else
-                        {
-                            //TODO ACK came for for a transfer we no longer have (ignore most likely)
-                        }
-                    }
-                    else
-                    {
-                        //TODO unknown header message_type (ignore most likely)
-                    }
+            /* the parity cannot start a transfer, the fragment size is not known from it */
+            auto itr = find_transfer(f, h, true);
+            if (itr != transfers.end() && itr->is_part_of(f, h) && itr->put_parity(h.fragment(), h.get_prev_id(), f))
+                deliver_if_complete(itr);
+        }
+
+        /* the size of the transfer is estimated from the fragment, it is exact for any but the last one */
+        bool is_streamed(const fragment & f, const Header & h) const
+        {
+            return _config.stream_threshold != 0 && transfer_chunk_event.has_subscribers() && 
+                static_cast<bytes::size_type>(h.fragments_total()) * f.data().size() >= _config.stream_threshold;
+        }
+
+        void deliver_if_complete(typename transfer_list_type::iterator itr)
+        {
+            if (itr->is_streaming())
+            {
+                itr->take_chunks([&](bytes::size_type offset, bytes && data){
+                    transfer_chunk_event.emit(transfer_chunk(*itr, offset, itr->get_transfer_size(), std::move(data)));
+                });
+                if (itr->is_complete())
+                {
+                    _completed.insert(transfers.key_of(*itr), itr->destination(), itr->get_fragments_total(), 
+                        itr->get_prev_id(), completed_expiry(itr->source()));
+                    erase_transfer(itr);
+                }
+            }
+            else if (itr->is_checksum_failed())
+            {
+#ifdef SP_FRAGMENTATION_WARNING
+                std::cout << "dropping incoming transfer id " << (int)itr->get_id() << " with a bad checksum" << std::endl;
+#endif
+                erase_transfer(itr);
+            }
+            else if (itr->is_complete())
+            {
+                /* only the fact that the transfer was delivered is kept from now on */
+                _completed.insert(transfers.key_of(*itr), itr->destination(), itr->get_fragments_total(), 
+                    itr->get_prev_id(), completed_expiry(itr->source()));
+                auto t = itr->take_transfer();
+                erase_transfer(itr);
+                transfer_receive_event.emit(std::move(t));
+            }
+        }
+
+        void receive_ack_fragment(const fragment & f, const Header & h)
+        {
+#ifdef SP_FRAGMENTATION_DEBUG
+            std::cout << "got fragment ACK for id " << (int)h.get_id() << " up to " << (int)h.fragment() << std::endl;
+#endif
+            auto itr = find_transfer(f, h, false);
+            if (itr != transfers.end() && itr->is_ack_of(f, h))
+            {
+                acknowledge(*itr, h.fragment(), h.type());
+
+                /* emit the ACK event for the sender and destroy this outgoing transfer
+                since we've done our job and don't need it anymore - in contrast to the 
+                incoming transfer where the transmitted ACK may not be received, here we
+                can be sure because if we receive another ACK for some reason, we'll 
+                just ignore it since we no longer store that transfer */
+                if (itr->is_complete())
+                {
+                    transmit_complete_event.emit(itr->object_id(), transmit_status::DONE);
+                    erase_transfer(itr);
                 }
             }
         }
+
+        void receive_request_fragment(const fragment & f, const Header & h)
+        {
+#ifdef SP_FRAGMENTATION_WARNING
+            std::cout << "handling retransmit request of id " << (int)h.get_id() << " fragment " << (int)h.fragment() << " of " << (int)h.fragments_total() << std::endl;
+#endif
+            auto itr = find_transfer(f, h, false);
+            if (itr != transfers.end() && itr->is_request_of(f, h))
+            {
+                /* the request implies that everything before the requested fragment was received,
+                the retransmit itself is handled in the main task, where we also decide what has 
+                the highest priority */
+                acknowledge(*itr, h.fragment() - 1, h.type());
+                if (itr->retransmit_request(h.fragment()))
+                    loss_detected(*itr, 1);
+            }
+        }
+
+        void receive_nack_fragment(const fragment & f, const Header & h)
+        {
+#ifdef SP_FRAGMENTATION_WARNING
+            std::cout << "handling NACK of id " << (int)h.get_id() << " from fragment " << (int)h.fragment() << " of " << (int)h.fragments_total() << std::endl;
+#endif
+            auto itr = find_transfer(f, h, false);
+            if (itr != transfers.end() && itr->is_request_of(f, h))
+            {
+                /* same as the request, but all the missing fragments are queued at once */
+                acknowledge(*itr, h.fragment() - 1, h.type());
+                if (auto queued = itr->negative_acknowledge(h.fragment(), f.data()); queued > 0)
+                    loss_detected(*itr, queued);
+            }
+        }
+
+        void receive_resend_fragment(const fragment & f, const Header & h)
+        {
+#ifdef SP_FRAGMENTATION_WARNING
+            std::cout << "handling resend of id " << (int)h.get_id() << " from fragment " << (int)h.fragment() << " of " << (int)h.fragments_total() << std::endl;
+#endif
+            /* the fragments got through but the data did not, this is not a loss of the link */
+            auto itr = find_transfer(f, h, false);
+            if (itr != transfers.end() && itr->is_request_of(f, h))
+                itr->resend_request(h.fragment(), h.get_prev_id());
+        }
+
+        void acknowledge(transfer_handler_type & t, index_type pos, message_types type)
+        {
+            auto before = t.get_acknowledged();
+            if (t.acknowledge(pos))
+            {
+                if (auto sample = t.take_rtt_sample())
+                    get_peer(t.destination()).rtt.sample(*sample);
+                transfer_progressed(t);
+                /* store the measurement of the round trip time */
+                if (before == 0 || pos == t.get_fragments_total())
+                    bordering_fragment_response_received(t, type);
+            }
+        }
         
         /* implementation of fragmentation_handler::do_main */
         void do_main()
         {
+            auto now = coarse_clock::now();
+            admit_deferred();
             /* go through all active transfers and perform housekeeping
             - purge old/inactive/finished transfers
             - send ACKs and REQUESTs */
@@ -206,41 +585,117 @@ namespace detail
             {
                 if (itr->is_outgoing())
                 {
-                    
-                    
+                    /* the window did not move for a while although we have fragments in flight */
+                    auto & rtt = get_peer(itr->destination()).rtt;
+                    auto last_activity = std::max(itr->get_last_progress_time(), itr->get_last_tx_time());
+                    if (itr->in_flight() > 0 && last_activity + rtt.rto() < now)
+                    {
+                        if (itr->get_retries() >= _config.max_retries)
+                        {
+                            transmit_complete_event.emit(itr->object_id(), transmit_status::UNREACHABLE);
+                            itr = erase_transfer(itr);
+                            continue;
+                        }
+                        if (itr->retransmit_oldest())
+                        {
+                            rtt.backoff();
+                            loss_detected(*itr, 1);
+                        }
+                    }
                 }
                 else if (itr->is_incoming())
                 {
-                    /*  */
+                    /* the peer keeps retransmitting for up to give_up_time, the incomplete transfer must 
+                    not be forgotten before that */
+                    const auto & rtt = get_peer(itr->source()).rtt;
+                    auto last_activity = std::max(itr->get_last_rx_time(), itr->get_last_tx_time());
+                    if (itr->get_last_rx_time() + rtt.give_up_time(_config.max_retries) * 2 < now)
+                    {
+                        itr = erase_transfer(itr);
+                        continue;
+                    }
+                    /* the rest of the transfer is late, ask for it again */
+                    if (last_activity + rtt.rto() < now)
+                        itr->request_response();
+                    
+                    if (itr->is_response_due(_config.ack_delay, _config.ack_every))
+                        response_due(itr->interface_id(), itr->source());
                 }
+                ++itr;
             }
 
-            if (!is_fragment_transmit_allowed())
-                return;
+            /* the final ACKs of the delivered transfers */
+            _completed.take_responses([&](const completed_transfer_cache::entry & e){
+                queue_ack(fragment_metadata(e.destination, e.key.peer, e.key.iid, now), create_completed_ack(e));
+                response_due(e.key.iid, e.key.peer);
+            });
 
-            /* select transfer with highest priority */
-            transfer_handler_type * to_transmit = nullptr;
-            for (auto & t : transfers)
+            /* once a response to the peer is due, the other pending ones go with it */
+            for (const auto & peer : _due_peers)
             {
-                if (t.is_outgoing() && t.is_transmit_ready() && is_peer_ready_to_receive_data_fragment(t))
-                {
-                    /* select the first one to pass the above, if there are more, select the max */
-                    if (!to_transmit)
-                        to_transmit = &t;
-                    else if(transfer_transmit_priority(*to_transmit) < transfer_transmit_priority(t))
-                        to_transmit = &t;
-                }
+                transfers.for_each_with_peer(peer.iid, peer.peer, true, [&](auto itr){
+                    if (!itr->is_response_pending())
+                        return;
+                    if (auto h = itr->get_response_ack(our_status().value))
+                        queue_ack(itr->create_response_fragment_metadata(), *h);
+                    else if (auto f = itr->get_response_fragment(_prealloc, our_status().value))
+                    {
+                        attach_acks(*f);
+                        transmit_fragment(std::move(*f));
+                    }
+                });
             }
+            _due_peers.clear();
+
+            if (is_fragment_transmit_allowed())
+                transmit_data_fragment(now);
             
-            if (to_transmit)
+            flush_acks();
+        }
+
+        void response_due(interface_identifier iid, address_type peer)
+        {
+            transfer_key k{iid, peer, 0, true};
+            if (std::find(_due_peers.begin(), _due_peers.end(), k) == _due_peers.end())
+                _due_peers.push_back(k);
+        }
+
+        void transmit_data_fragment(clock::time_point now)
+        {
+            /* select the transfer to transmit, see transfer_scheduler */
+            auto slot = _scheduler.select([&](transfer_scheduler::slot_type s){
+                const auto & t = *transfers.at(s);
+                return t.is_transmit_ready(transmit_window(t.destination())) && 
+                    !is_peer_in_holdoff(t.destination(), now) && is_peer_ready_to_receive_data_fragment(t);
+            }, [&](transfer_scheduler::slot_type s){
+                return transfer_transmit_priority(*transfers.at(s));
+            });
+            
+            if (slot)
             {
-                if (auto f = to_transmit->get_current_fragment(_prealloc))
+                auto to_transmit = transfers.at(*slot);
+                /* the parity is decided for the whole transfer before it starts */
+                to_transmit->set_parity_block(fec_block(to_transmit->destination()));
+                if (auto f = to_transmit->get_next_fragment(transmit_window(to_transmit->destination()), _prealloc, our_status().value))
                 {
+                    _scheduler.charge(*slot, f->data().size());
+                    transfers.update_fragment_index(to_transmit);
+                    data_fragment_transmitted(*to_transmit, *f);
+                    if (auto type = parsers::byte_copy<Header>(f->data().begin()).type(); 
+                        type == message_types::FRAGMENT || type == message_types::FRAGMENT_CHECKED)
+                        fragment_sent(to_transmit->destination());
+                    
+                    /* the pending ACKs to the peer ride along even if they are not due yet */
+                    transfers.for_each_with_peer(to_transmit->interface_id(), f->destination(), true, [&](auto itr){
+                        if (auto h = itr->get_response_ack(our_status().value))
+                            queue_ack(itr->create_response_fragment_metadata(), *h);
+                    });
+                    attach_acks(*f);
                     transmit_fragment(std::move(*f));
                 }
                 else
                 {
-                    //TODO get_current_fragment failed - internal handling error
+                    //TODO get_next_fragment failed - internal handling error
                 }
             }
         }
@@ -253,39 +708,284 @@ namespace detail
 #elif defined(SP_FRAGMENTATION_WARNING)
             std::cout << "transmit got id " << (int)t.get_id() << std::endl;
 #endif
-            //TODO limit the number of stored transfers
-            transfers.emplace_back(std::move(t), max_fragment_data_size());
+            if (!t.data() || max_fragment_data_size() <= transfer_handler_type::length_size || 
+                t.get_id() > std::numeric_limits<typename Header::id_type>::max() ||
+                transfer_handler_type::fragments_needed(t.data().size(), max_fragment_data_size(), 
+                    _config.checksum_transfers ? transfer_checksum::size : 0) > std::numeric_limits<typename Header::index_type>::max() ||
+                t.data().size() > std::numeric_limits<typename transfer_handler_type::length_type>::max())
+            {
+                transmit_complete_event.emit(t.object_id(), transmit_status::DROPPED);
+                return;
+            }
+            auto size = outgoing_footprint(t);
+            bool defer = _config.outgoing_budget.policy == admission_policy::DEFER;
+            /* nothing overtakes the deferred transfers, a flow of small ones would starve a large one */
+            if ((defer && !_deferred.empty()) || !admit(false, size))
+            {
+                if (defer && fits(_config.outgoing_budget, _deferred_usage, size))
+                {
+                    _deferred_usage.size += size;
+                    ++_deferred_usage.count;
+                    _deferred.push_back(std::move(t));
+                }
+                else
+                    transmit_complete_event.emit(t.object_id(), transmit_status::BUSY);
+                return;
+            }
+            start_transmit(std::move(t));
+        }
+
+        void start_transmit(transfer t)
+        {
+            auto itr = transfers.emplace(std::move(t), max_fragment_data_size(), _config.checksum_transfers);
+            account(*itr, true);
+            _scheduler.add(itr.index(), itr->destination(), itr->get_priority());
+        }
+
+        /* the deferred outgoing transfers go in the order they came in as soon as there is room */
+        void admit_deferred()
+        {
+            while (!_deferred.empty())
+            {
+                auto size = outgoing_footprint(_deferred.front());
+                if (!fits(_config.outgoing_budget, _outgoing_usage, size))
+                    return;
+                _deferred_usage.size -= size;
+                --_deferred_usage.count;
+                auto t = std::move(_deferred.front());
+                _deferred.pop_front();
+                start_transmit(std::move(t));
+            }
+        }
+
+        /* the memory the transfer counts with against its budget, see transfer_budget */
+        bytes::size_type footprint(index_type fragments_total, bytes::size_type fragment_size, bool streamed) const
+        {
+            if (streamed)
+                fragments_total = std::min<index_type>(fragments_total, _config.window_size * 2);
+            return static_cast<bytes::size_type>(fragments_total) * fragment_size;
+        }
+
+        bytes::size_type outgoing_footprint(const transfer & t) const
+        {
+            return footprint(transfer_handler_type::fragments_needed(t.data().size(), max_fragment_data_size(), 
+                _config.checksum_transfers ? transfer_checksum::size : 0), max_fragment_data_size(), false);
+        }
+
+        static bool fits(const transfer_budget & budget, const budget_usage & usage, bytes::size_type size)
+        {
+            return (budget.count == 0 || usage.count < budget.count) && 
+                (budget.size == 0 || usage.size + size <= budget.size);
+        }
+
+        /* true if a new transfer of size bytes fits into the budget of its direction, 
+        possibly after evicting the stalled ones */
+        bool admit(bool incoming, bytes::size_type size)
+        {
+            const auto & budget = incoming ? _config.incoming_budget : _config.outgoing_budget;
+            const auto & usage = incoming ? _incoming_usage : _outgoing_usage;
+            if (budget.size != 0 && size > budget.size)
+                return false;
+            while (!fits(budget, usage, size))
+                if (budget.policy != admission_policy::EVICT_STALLED || !evict_stalled(incoming))
+                    return false;
+            return true;
+        }
+
+        /* removes the transfer of the direction that did not hear from its peer for the longest time, 
+        provided that it is stalled, returns false if there is none */
+        bool evict_stalled(bool incoming)
+        {
+            auto now = coarse_clock::now();
+            auto oldest = transfers.end();
+            for (auto itr = transfers.begin(); itr != transfers.end(); ++itr)
+                if (itr->is_incoming() == incoming && itr->get_last_rx_time() + _config.stall_time <= now && 
+                    (oldest == transfers.end() || itr->get_last_rx_time() < oldest->get_last_rx_time()))
+                    oldest = itr;
+            if (oldest == transfers.end())
+                return false;
+
+#ifdef SP_FRAGMENTATION_WARNING
+            std::cout << "evicting stalled transfer id " << (int)oldest->get_id() << std::endl;
+#endif
+            if (oldest->is_outgoing())
+                transmit_complete_event.emit(oldest->object_id(), transmit_status::BUSY);
+            erase_transfer(oldest);
+            return true;
+        }
+
+        /* adds or removes (see erase_transfer()) the transfer from the usage of its budget */
+        void account(const transfer_handler_type & t, bool add)
+        {
+            auto & usage = t.is_incoming() ? _incoming_usage : _outgoing_usage;
+            auto size = footprint(t.get_fragments_total(), t.get_max_fragment_data_size(), t.is_incoming() && t.is_streaming());
+            if (add)
+            {
+                usage.size += size;
+                ++usage.count;
+            }
+            else
+            {
+                usage.size -= size;
+                --usage.count;
+                if (t.is_incoming())
+                    _incoming_busy = false;
+            }
         }
 
         /* implementation of fragmentation_handler::transmit_began_callback */
         void transmit_began_callback(object_id_type id)
         {
-            auto ptr = find_transfer([&id](const auto & tr){return tr.is_fragment_transmitted_of(id);});
-            if (ptr != transfers.end())
+            auto itr = transfers.find_transmitted(id);
+            if (itr != transfers.end() && itr->fragment_transmitted(id))
+                transfers.update_fragment_index(itr);
+        }
+
+        /* number of unacknowledged data fragments we allow towards the peer */
+        index_type transmit_window(address_type addr) const
+        {
+            auto peer = find_peer(addr);
+            if (peer == _peers.end() || !peer->status.rx_poor())
+                return _config.window_size;
+            if (peer->status.rx_critical())
+                return 1;
+            return std::max<index_type>(1, _config.window_size / 2);
+        }
+
+        void fragment_sent(address_type addr)
+        {
+            auto & peer = get_peer(addr);
+            if (++peer.fragments_sent > max_loss_samples)
             {
-                /* start measuring Round Trip Time */
-                if (!ptr->fragment_transmitted())
-                {
-                    //TODO some transfer state error
-                }
+                peer.fragments_sent /= 2;
+                peer.fragments_lost /= 2;
             }
+        }
+
+        void loss_detected(const transfer_handler_type & t, index_type count)
+        {
+            get_peer(t.destination()).fragments_lost += count;
+            transfer_loss_detected(t);
+        }
+
+        typename transfer_list_type::iterator erase_transfer(typename transfer_list_type::iterator itr)
+        {
+            account(*itr, false);
+            _scheduler.remove(itr.index());
+            return transfers.erase(itr);
+        }
+
+        /* find the transfer the fragment belongs to, the peer is its source */
+        inline typename transfer_list_type::iterator find_transfer(const fragment & f, const Header & h, bool incoming)
+        {
+            return transfers.find(transfer_key{f.interface_id(), f.source(), h.get_id(), incoming});
+        }
+
+        inline Header create_header(message_types type, const Header & h) const
+        {
+            return Header(type, h.fragment(), h.fragments_total(), h.get_id(), h.get_prev_id(), our_status().value);
+        }
+
+        /* the cumulative ACK of the whole delivered transfer */
+        Header create_completed_ack(const completed_transfer_cache::entry & e) const
+        {
+            return Header(message_types::FRAGMENT_ACK, e.fragments_total, e.fragments_total, 
+                e.key.id, e.prev_id, our_status().value);
+        }
+
+        /* ACKs carry no data, so all the ACKs to the peer are sent in a single fragment, or in front of 
+        a data fragment or a NACK to the peer (see do_receive()), m is the metadata of the response */
+        void queue_ack(const fragment_metadata & m, const Header & h)
+        {
+            auto b = std::find_if(_ack_batches.begin(), _ack_batches.end(), [&](const ack_batch & ab){
+                return ab.metadata.destination() == m.destination() && ab.metadata.interface_id() == m.interface_id();
+            });
+            if (b == _ack_batches.end())
+                b = _ack_batches.insert(_ack_batches.end(), ack_batch{m, bytes()});
+            else if (b->headers.size() + sizeof(Header) > _interface.max_data_size())
+            {
+                transmit_fragment(create_ack_fragment(*b));
+                b->headers.clear();
+            }
+            b->headers.push_back(to_bytes(h));
+        }
+
+        /* puts the queued ACKs to the destination of f in front of its data if they fit */
+        void attach_acks(fragment & f)
+        {
+            auto b = std::find_if(_ack_batches.begin(), _ack_batches.end(), [&](const ack_batch & ab){
+                return ab.metadata.destination() == f.destination() && ab.metadata.interface_id() == f.interface_id();
+            });
+            if (b == _ack_batches.end())
+                return;
+
+            if (f.data().size() + b->headers.size() > _interface.max_data_size())
+                transmit_fragment(create_ack_fragment(*b));
             else
             {
-                //TODO transmit_began_callback of fragment we no longer have
+                /* keep the room for the lower layers */
+                f.data().reserve(b->headers.size() + _prealloc.front(), _prealloc.back());
+                f.data().push_front(b->headers);
             }
+            _ack_batches.erase(b);
+        }
+
+        /* sends the ACKs that did not find a ride */
+        void flush_acks()
+        {
+            for (const auto & b : _ack_batches)
+                transmit_fragment(create_ack_fragment(b));
+            _ack_batches.clear();
         }
 
+        fragment create_ack_fragment(const ack_batch & b) const
+        {
+            auto data = _prealloc.create(b.headers.size());
+            std::copy(b.headers.begin(), b.headers.end(), data.begin());
+            return fragment(fragment_metadata(b.metadata), std::move(data));
+        }
 
+        /* the peer keeps retransmitting for up to give_up_time, the delivered transfer needs to be 
+        remembered until then so that the retransmits are not mistaken for a new transfer */
+        clock::time_point completed_expiry(address_type peer)
+        {
+            auto give_up = get_peer(peer).rtt.give_up_time(_config.max_retries);
+            return coarse_clock::now() + std::max(give_up, _config.minimum_incoming_hold_time);
+        }
 
-        /* find first transfer in the internal transfer buffer that satisfies pred */
-        inline typename transfer_list_type::iterator find_transfer(std::function<bool(const transfer_handler_type &)> pred)
+        typename peer_list_type::const_iterator find_peer(address_type addr) const
         {
-            return std::find_if(transfers.begin(), transfers.end(), pred);
+            return std::find_if(_peers.begin(), _peers.end(), [&](const peer_state & ps){
+                return ps.addr == addr;
+            });
         }
 
-        inline Header create_header(message_types type, const Header & h) const
+        /* returns the state of the peer, creates a new one if we have not seen it yet */
+        peer_state & get_peer(address_type addr)
+        {
+            auto peer = std::find_if(_peers.begin(), _peers.end(), [&](const peer_state & ps){
+                return ps.addr == addr;
+            });
+            if (peer == _peers.end())
+                return _peers.emplace_front(addr, new_estimator());
+            else
+                return *peer;
+        }
+
+        rtt_estimator new_estimator() const
+        {
+            return rtt_estimator(_config.initial_rto, _config.min_rto, _config.max_rto);
+        }
+
+        /* called for every valid header, the peer is throttled when it reports receive pressure */
+        virtual void peer_status_received(address_type addr, status_type status)
         {
-            return Header(type, h.fragment(), h.fragments_total(), h.get_id(), h.get_prev_id(), 0);
+            auto & peer = get_peer(addr);
+            peer.status = status;
+            if (status.rx_critical())
+                peer.tx_holdoff = coarse_clock::now() + _config.pressure_holdoff * 3;
+            else if (status.rx_poor())
+                peer.tx_holdoff = coarse_clock::now() + _config.pressure_holdoff;
         }
 
         /* data size before the header is added */
@@ -295,11 +995,6 @@ namespace detail
             return _interface.max_data_size() - sizeof(Header);
         }
 
-        void transmit_fragment(fragment f)
-        {
-            transmit_event.emit(std::move(f));
-        }
-
         public:
 
 /*         void print_debug() const
@@ -61,7 +61,7 @@ namespace sp::detail
             {
                 auto data = _prealloc.create(t.data().size());
                 std::copy(t.data().begin(), t.data().end(), data.begin());
-                transmit_event.emit(fragment(t.get_fragment_metadata(), std::move(data)));
+                transmit_fragment(fragment(t.get_fragment_metadata(), std::move(data)));
             }
         }
 
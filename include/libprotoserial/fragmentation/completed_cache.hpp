@@ -0,0 +1,135 @@
+/*
+ * This file is a part of the libprotoserial project
+ * https://github.com/georges-circuits/libprotoserial
+ *
+ * Copyright (C) 2022 Jiří Maňák - All Rights Reserved
+ * For contact information visit https://manakjiri.eu/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/gpl.html>
+ */
+
+#ifndef _SP_FRAGMENTATION_COMPLETEDCACHE
+#define _SP_FRAGMENTATION_COMPLETEDCACHE
+
+#include "libprotoserial/fragmentation/transfer.hpp"
+#include "libprotoserial/fragmentation/transfer_table.hpp"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+namespace sp
+{
+    /* remembers the incoming transfers that were already delivered, so that the fragments the peer
+    retransmits because it did not get our final ACK are acknowledged again instead of starting
+    a new transfer and delivering it twice
+    the entries live in a ring of fixed capacity indexed by their transfer_key, the oldest entry is
+    overwritten when the ring is full, so the memory does not depend on the traffic, entries also
+    expire on their own */
+    class completed_transfer_cache
+    {
+        public:
+        using size_type = std::size_t;
+        using address_type = fragment_metadata::address_type;
+        using index_type = transfer_metadata::index_type;
+        using id_type = transfer_metadata::id_type;
+
+        struct entry
+        {
+            transfer_key key;
+            /* our address, the destination of the transfer */
+            address_type destination = 0;
+            index_type fragments_total = 0;
+            id_type prev_id = 0;
+            clock::time_point expiry = never();
+            /* the peer should get the final ACK (again) */
+            bool response_pending = false;
+            bool valid = false;
+        };
+
+        completed_transfer_cache(size_type capacity) :
+            _ring(std::max<size_type>(capacity, 1))
+        {
+            _index.reserve(_ring.size());
+            _pending.reserve(_ring.size());
+        }
+
+        /* remembers the delivered transfer until expiry, or refreshes the entry if it is already
+        there, either way the final ACK becomes pending */
+        void insert(const transfer_key & key, address_type destination, index_type fragments_total,
+            id_type prev_id, clock::time_point expiry)
+        {
+            size_type i;
+            auto k = _index.find(key);
+            if (k != _index.end())
+                i = k->second;
+            else
+            {
+                i = _next;
+                _next = (_next + 1) % _ring.size();
+                if (_ring[i].valid)
+                    _index.erase(_ring[i].key);
+                _index[key] = i;
+            }
+
+            auto & e = _ring[i];
+            if (!e.response_pending)
+                _pending.push_back(i);
+            e = entry{key, destination, fragments_total, prev_id, expiry, true, true};
+        }
+
+        /* the entry of the delivered transfer, nullptr if it is not known or it has expired */
+        const entry * find(const transfer_key & key, clock::time_point now)
+        {
+            auto k = _index.find(key);
+            if (k == _index.end())
+                return nullptr;
+
+            auto & e = _ring[k->second];
+            if (e.expiry < now)
+            {
+                e.valid = false;
+                _index.erase(k);
+                return nullptr;
+            }
+            return &e;
+        }
+
+        /* calls f(const entry &) for every entry with a pending response and clears the flags */
+        template<typename F>
+        void take_responses(F f)
+        {
+            for (auto i : _pending)
+            {
+                auto & e = _ring[i];
+                if (e.valid && e.response_pending)
+                    f(e);
+                e.response_pending = false;
+            }
+            _pending.clear();
+        }
+
+        size_type size() const {return _index.size();}
+        size_type capacity() const {return _ring.size();}
+
+        private:
+        std::vector<entry> _ring;
+        std::unordered_map<transfer_key, size_type, transfer_key::hash> _index;
+        /* ring positions with response_pending set */
+        std::vector<size_type> _pending;
+        size_type _next = 0;
+    };
+}
+
+#endif
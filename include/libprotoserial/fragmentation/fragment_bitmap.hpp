@@ -0,0 +1,156 @@
+/*
+ * This file is a part of the libprotoserial project
+ * https://github.com/georges-circuits/libprotoserial
+ *
+ * Copyright (C) 2022 Jiří Maňák - All Rights Reserved
+ * For contact information visit https://manakjiri.eu/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/gpl.html>
+ */
+
+#ifndef _SP_FRAGMENTATION_FRAGMENT_BITMAP
+#define _SP_FRAGMENTATION_FRAGMENT_BITMAP
+
+#include "libprotoserial/data/container.hpp"
+
+#include <vector>
+#include <bit>
+#include <cstdint>
+
+namespace sp
+{
+    /* one bit per fragment of a transfer, positions are zero based
+    the serialized form (used in FRAGMENT_NACK) is little endian bit order, bit 0 of the
+    first byte is the first position */
+    class fragment_bitmap
+    {
+        using word_type = std::uint32_t;
+        static constexpr std::size_t word_bits = 32;
+
+        public:
+        using size_type = std::size_t;
+        static constexpr size_type npos = static_cast<size_type>(-1);
+
+        fragment_bitmap(size_type bits = 0) :
+            _words(words_for(bits), 0), _size(bits) {}
+
+        /* resizes the bitmap and clears all bits */
+        void resize(size_type bits)
+        {
+            _words.assign(words_for(bits), 0);
+            _size = bits;
+        }
+
+        void clear()
+        {
+            std::fill(_words.begin(), _words.end(), 0);
+        }
+
+        bool test(size_type pos) const
+        {
+            return pos < _size && (_words[pos / word_bits] & mask(pos)) != 0;
+        }
+
+        void set(size_type pos)
+        {
+            if (pos < _size)
+                _words[pos / word_bits] |= mask(pos);
+        }
+
+        void reset(size_type pos)
+        {
+            if (pos < _size)
+                _words[pos / word_bits] &= ~mask(pos);
+        }
+
+        size_type size() const
+        {
+            return _size;
+        }
+
+        size_type count() const
+        {
+            size_type c = 0;
+            for (auto w : _words)
+                c += std::popcount(w);
+            return c;
+        }
+
+        /* position of the first clear bit at or after from, npos if there is none */
+        size_type find_first_clear(size_type from = 0) const
+        {
+            for (auto pos = from; pos < _size;)
+            {
+                auto w = ~_words[pos / word_bits] >> (pos % word_bits);
+                if (w != 0)
+                {
+                    pos += std::countr_zero(w);
+                    return pos < _size ? pos : npos;
+                }
+                pos += word_bits - pos % word_bits;
+            }
+            return npos;
+        }
+
+        /* position of the last set bit, npos if there is none */
+        size_type find_last_set() const
+        {
+            for (auto i = _words.size(); i > 0; --i)
+                if (_words[i - 1] != 0)
+                    return (i - 1) * word_bits + word_bits - 1 - std::countl_zero(_words[i - 1]);
+            return npos;
+        }
+
+        /* number of bytes needed to serialize n bits */
+        static constexpr size_type bytes_for(size_type n)
+        {
+            return n / 8 + (n % 8 == 0 ? 0 : 1);
+        }
+
+        /* serializes n bits starting at from into bytes_for(n) bytes at out, bits past size() are clear */
+        void copy_to(size_type from, size_type n, bytes::iterator out) const
+        {
+            for (size_type i = 0; i < bytes_for(n); ++i)
+            {
+                byte b = (byte)0;
+                for (size_type j = 0; j < 8 && i * 8 + j < n; ++j)
+                    if (test(from + i * 8 + j))
+                        b |= (byte)(1 << j);
+                *(out + i) = b;
+            }
+        }
+
+        /* reads the bit at pos of a serialized bitmap */
+        static bool test(const bytes & serialized, size_type pos)
+        {
+            return pos / 8 < serialized.size() &&
+                (serialized[pos / 8] & (byte)(1 << (pos % 8))) != (byte)0;
+        }
+
+        private:
+        static constexpr size_type words_for(size_type bits)
+        {
+            return bits / word_bits + (bits % word_bits == 0 ? 0 : 1);
+        }
+        static constexpr word_type mask(size_type pos)
+        {
+            return word_type(1) << (pos % word_bits);
+        }
+
+        std::vector<word_type> _words;
+        size_type _size;
+    };
+}
+
+#endif
@@ -76,7 +76,10 @@ namespace sp
             TIMEDOUT,
             /* part of the transfer was dropped by the interface,
             this usually means that the transfer was malformed */
-            DROPPED
+            DROPPED,
+            /* the handler had no room for the transfer within its budget, see
+            base_fragmentation_handler, it may be transmitted again later */
+            BUSY
         };
 
         fragmentation_handler(interface & i, prealloc_size prealloc) :
@@ -89,6 +92,7 @@ namespace sp
         
         void main_task()
         {
+            coarse_clock::update();
             do_main();
         }
 
@@ -97,12 +101,13 @@ namespace sp
             do_transmit(std::move(t));
         }
         
-        /* shortcut for event subscribe */
+        /* shortcut for event subscribe, the fragments are then handed over to l directly
+        (see transmit_fragment()) */
         void bind_to(interface & l)
         {
             l.receive_event.subscribe(&fragmentation_handler::receive_callback, this);
             l.transmit_began_event.subscribe(&fragmentation_handler::transmit_began_callback, this);
-            transmit_event.subscribe(&interface::transmit, &l);
+            _bound = &l;
         }
 
         interface_identifier interface_id() const
@@ -110,10 +115,14 @@ namespace sp
             return _interface.interface_id();
         }
 
-        /* fires when the handler wants to transmit a fragment, complemented by receive_callback */
+        /* fires when the handler wants to transmit a fragment, complemented by receive_callback, 
+        once bound (see bind_to()) the subscribers get copies and the original goes to the interface */
         subject<fragment> transmit_event;
         /* fires when the handler receives and fully reconstructs a fragment, complemented by transmit */
         subject<transfer> transfer_receive_event;
+        /* fires with the pieces of the incoming transfers the handler streams instead of reconstructing 
+        them in memory, those do not fire transfer_receive_event (see base_fragmentation_handler) */
+        subject<transfer_chunk> transfer_chunk_event;
         /* fires when the transmit process ended and the transfer was discarded by the handler */
         subject<object_id_type, transmit_status> transmit_complete_event;
 
@@ -127,8 +136,24 @@ namespace sp
             (void)id; //TODO
         }
 
+        /* the interface reports the fragment back through transmit_began_callback by its object ID, 
+        which only the original keeps (a copy of an sp_object gets a new ID), so the bound interface 
+        gets the original regardless of who else subscribed to transmit_event */
+        void transmit_fragment(fragment f)
+        {
+            if (!_bound)
+            {
+                transmit_event.emit(std::move(f));
+                return;
+            }
+            if (transmit_event.has_subscribers())
+                transmit_event.emit(f);
+            _bound->transmit(std::move(f));
+        }
+
         prealloc_size _prealloc;
         interface & _interface;
+        interface * _bound = nullptr;
     };
 }
 
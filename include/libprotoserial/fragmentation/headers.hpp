@@ -28,11 +28,42 @@ namespace sp
 {
     namespace headers
     {
-        struct __attribute__ ((__packed__)) fragment_8b8b
+        /* receiver pressure level, carried in the status field of every fragmentation header,
+        it tells the peer how full our interface receive buffer is so that it can throttle */
+        struct fragment_status
         {
-            typedef std::uint8_t        index_type;
-            typedef std::uint8_t        id_type;
-            typedef std::uint8_t        status_type;
+            typedef std::uint8_t        value_type;
+
+            static constexpr value_type RX_POOR = 0x01;
+            static constexpr value_type RX_CRITICAL = 0x03;
+
+            constexpr fragment_status(value_type v = 0) : value(v) {}
+
+            /* derive the status from the interface load using the poor and critical thresholds
+            in bytes, a threshold of 0 disables the respective level */
+            constexpr fragment_status(const interface::status & s, bytes::size_type poor, bytes::size_type critical) :
+                value(0)
+            {
+                if (critical != 0 && s.receive_buffer_level >= critical)
+                    value = RX_CRITICAL;
+                else if (poor != 0 && s.receive_buffer_level >= poor)
+                    value = RX_POOR;
+            }
+
+            constexpr bool rx_poor() const {return (value & RX_POOR) == RX_POOR;}
+            constexpr bool rx_critical() const {return (value & RX_CRITICAL) == RX_CRITICAL;}
+
+            value_type value;
+        };
+
+        /* the fragmentation header, Index limits the number of fragments of a transfer and 
+        Id the number of transfer IDs in circulation before they wrap (see id_factory) */
+        template<typename Index, typename Id>
+        struct __attribute__ ((__packed__)) fragment_header
+        {
+            typedef Index               index_type;
+            typedef Id                  id_type;
+            typedef fragment_status::value_type status_type;
 
             enum message_types: std::uint8_t
             {
@@ -40,13 +71,23 @@ namespace sp
                 FRAGMENT,
                 FRAGMENT_ACK,
                 FRAGMENT_REQ,
+                /* carries a fragment_bitmap, see transfer_handler */
+                FRAGMENT_NACK,
+                /* XOR of the data fragments starting at fragment, the prev_id field carries
+                their count, see transfer_handler */
+                FRAGMENT_PARITY,
+                /* a FRAGMENT of a transfer that ends with the CRC32 of everything before it */
+                FRAGMENT_CHECKED,
+                /* the transfer failed the CRC32, the fragments starting at fragment are to be sent
+                again, the prev_id field carries their count, see transfer_handler */
+                FRAGMENT_RESEND,
             };
 
-            fragment_8b8b() = default;
-            fragment_8b8b(message_types type, index_type fragment, index_type fragments_total, id_type id, id_type prev_id, status_type status):
+            fragment_header() = default;
+            fragment_header(message_types type, index_type fragment, index_type fragments_total, id_type id, id_type prev_id, status_type status):
                 _type(type), _fragment(fragment), _fragments_total(fragments_total), _id(id), _prev_id(prev_id), _status(status)
             {
-                _check = (byte)(_type + _fragment + _fragments_total + _id + _prev_id + _status);
+                _check = checksum();
             }
 
             message_types type() const {return _type;}
@@ -55,37 +96,28 @@ namespace sp
             id_type get_id() const {return _id;}
             id_type get_prev_id() const {return _prev_id;}
             status_type status() const {return _status;}
+            fragment_status get_status() const {return fragment_status(_status);}
             
             /* only basic sanity checks are performed, type is not checked, here we assume that this is a secondary
             header, it should already be checksummed by the lower layer, the only real reason for this check
             is the case where the contra-peer does not use this header when we expect it */
             bool is_valid() const 
             {
-                return _check == (byte)(_type + _fragment + _fragments_total + _id + _prev_id + _status) && 
+                return _check == checksum() && 
                     _fragment != 0 && _fragments_total != 0 && _fragment <= _fragments_total && _id != 0;
             }
 
-            /* struct status
+            private:
+            /* sum of all the bytes preceding _check */
+            byte checksum() const
             {
-                status(const fragment_8b8b & h) : value(h.status()) {}
-                status(const interface::status & s, const configuration & c)
-                {
-                    //TODO in handler
-                    value = 0;
-                    if (s.receive_buffer_level >= c.frb_critical)
-                        value |= 0x03;
-                    else if (s.receive_buffer_level >= c.frb_poor)
-                        value |= 0x01;
-                }
-                
-                bool rx_poor() {return (value & 0x01) == 0x01;}
-                bool rx_critical() {return (value & 0x03) == 0x03;}
-                
-                private:
-                status_type value;
-            }; */
+                auto p = reinterpret_cast<const byte*>(this);
+                std::uint8_t sum = 0;
+                for (std::size_t i = 0; i < sizeof(*this) - sizeof(_check); ++i)
+                    sum += static_cast<std::uint8_t>(p[i]);
+                return (byte)sum;
+            }
 
-            private:
             message_types _type = INIT;
             index_type _fragment = 0;
             index_type _fragments_total = 0;
@@ -94,6 +126,12 @@ namespace sp
             status_type _status = 0;
             byte _check = (byte)0;
         };
+
+        /* up to 255 fragments per transfer and 255 transfer IDs */
+        using fragment_8b8b = fragment_header<std::uint8_t, std::uint8_t>;
+        /* up to 65535 fragments per transfer and 65535 transfer IDs, for large transfers 
+        and high transfer rates */
+        using fragment_16b16b = fragment_header<std::uint16_t, std::uint16_t>;
     }
 }
 
@@ -35,38 +35,56 @@ namespace sp
         using id_type = uint;
         
         private:
+        /* the IDs fit into the 8 bit ID of the default fragmentation header unless told otherwise */
+        static constexpr id_type default_max_id = 255;
+
         struct mapper
         {
             interface_identifier interface_id;
             id_type id_count;
+            id_type max_id;
 
             mapper(interface_identifier iid) : 
-                interface_id(iid), id_count(0) {}
+                interface_id(iid), id_count(0), max_id(default_max_id) {}
         };
 
         std::list<mapper> _mappers;
 
-        id_type increment_id(id_type & id_counter)
+        /* IDs go from 1 to max_id, 0 is the invalid ID */
+        id_type increment_id(mapper & m)
         {
-            ++id_counter;
-            if ((std::uint8_t)id_counter == 0) ++id_counter;
-            return id_counter;
+            if (m.id_count >= m.max_id)
+                m.id_count = 0;
+            return ++m.id_count;
         }
 
-        public:
-
-        id_type new_id(interface_identifier iid)
+        mapper & get_mapper(interface_identifier iid)
         {
             auto mit = std::find_if(_mappers.begin(), _mappers.end(), [&](const auto & mp){
                 return mp.interface_id == iid;
             });
             if (mit == _mappers.end())
-            {
-                auto & m = _mappers.emplace_back(iid);
-                return increment_id(m.id_count);
-            }
+                return _mappers.emplace_back(iid);
             else
-                return increment_id(mit->id_count);
+                return *mit;
+        }
+
+        public:
+
+        id_type new_id(interface_identifier iid)
+        {
+            return increment_id(get_mapper(iid));
+        }
+
+        /* the fragmentation handler of the interface sets the largest ID its header can carry */
+        void set_max_id(interface_identifier iid, id_type max)
+        {
+            get_mapper(iid).max_id = max;
+        }
+
+        id_type get_max_id(interface_identifier iid)
+        {
+            return get_mapper(iid).max_id;
         }
     };
 
@@ -0,0 +1,232 @@
+/*
+ * This file is a part of the libprotoserial project
+ * https://github.com/georges-circuits/libprotoserial
+ *
+ * Copyright (C) 2022 Jiří Maňák - All Rights Reserved
+ * For contact information visit https://manakjiri.eu/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/gpl.html>
+ */
+
+
+#ifndef _SP_FRAGMENTATION_PACEDHANDLER
+#define _SP_FRAGMENTATION_PACEDHANDLER
+
+#include "libprotoserial/fragmentation/base_handler.hpp"
+#include "libprotoserial/utils/bit_rate.hpp"
+
+namespace sp::detail
+{
+    /* base_fragmentation_handler with per-peer AIMD rate control, data fragments towards each peer are
+    paced by a token bucket filled at the peer's transmit rate
+
+    the rate starts at initial_rate and doubles every round trip (slow start) until the first loss, then
+    it grows by rate_increase every round trip, loss (retransmit timeout or a request from the peer) and
+    critical receiver pressure reported by the peer multiply it by rate_decrease, at most once per round trip
+    (rx_poor only stops the growth, the base class holds the peer off for a while in that case)
+    so that a single loss episode is not counted several times, senders sharing a medium converge to
+    a fair share of it
+    the increase and the decrease are timed separately, a loss undoes an increase from the same round trip
+    (a NACK usually acknowledges fragments as well) and there is no increase for a round trip after it */
+    template<class Header>
+    class paced_fragmentation_handler : public base_fragmentation_handler<Header>
+    {
+        using base = base_fragmentation_handler<Header>;
+
+        public:
+        using typename base::address_type;
+        using typename base::status_type;
+        using typename base::message_types;
+        using base::peer_rtt;
+
+        struct configuration : public base::configuration
+        {
+            /* transmit rate limits of a single peer */
+            bit_rate initial_rate, min_rate, max_rate;
+            /* additive increase of the transmit rate per round trip */
+            bit_rate rate_increase;
+            /* multiplicative decrease of the transmit rate on loss, in (0, 1) */
+            double rate_decrease;
+            /* capacity of the token bucket in bytes, the maximum burst towards a single peer */
+            bytes::size_type burst_size;
+            /* data fragments are not handed over to the interface while its transmit queue holds this many,
+            otherwise the queue and not the pacer would decide the timing */
+            uint max_queued_fragments;
+
+            configuration(const interface & i) :
+                base::configuration(i)
+            {
+                /* start slow enough for a 9600 baud link, slow start gets us to a fast link quickly */
+                initial_rate = 9600;
+                min_rate = 1200;
+                max_rate = 100'000'000;
+                rate_increase = 9600;
+                rate_decrease = 0.5;
+                burst_size = 2 * i.max_data_size();
+                max_queued_fragments = 2;
+            }
+        };
+
+        paced_fragmentation_handler(interface & i, prealloc_size prealloc, configuration c) :
+            base(i, prealloc, c), _pacing(c) {}
+
+        paced_fragmentation_handler(interface & i, prealloc_size prealloc) :
+            paced_fragmentation_handler(i, prealloc, configuration(i)) {}
+
+        paced_fragmentation_handler(interface & i) :
+            paced_fragmentation_handler(i, i.minimum_prealloc()) {}
+
+        /* the current transmit rate towards the peer */
+        bit_rate peer_rate(address_type addr) const
+        {
+            auto p = find_pacer(addr);
+            return p != _pacers.end() ? p->rate : _pacing.initial_rate;
+        }
+
+        protected:
+        using typename base::transfer_handler_type;
+        using base::_interface;
+        using base::_peers;
+        using base::_config;
+        using base::find_peer;
+
+        struct pacer_state
+        {
+            pacer_state(address_type a, const configuration & c) :
+                addr(a), rate(c.initial_rate), rate_before_increase(c.initial_rate), tokens(c.burst_size),
+                last_refill(coarse_clock::now()), last_increase(never()), last_decrease(never()) {}
+
+            address_type addr;
+            bit_rate rate, rate_before_increase;
+            /* token bucket level in bytes */
+            double tokens;
+            clock::time_point last_refill, last_increase, last_decrease;
+            /* false after the first loss */
+            bool slow_start = true;
+        };
+
+        using pacer_list_type = std::list<pacer_state>;
+
+        pacer_list_type _pacers;
+        configuration _pacing;
+
+        /* transfers with pending retransmits go first, those hold up the peer's delivery */
+        int transfer_transmit_priority(const transfer_handler_type & t)
+        {
+            return t.has_pending_retransmits() ? 1 : 0;
+        }
+
+        bool is_peer_ready_to_receive_data_fragment(const transfer_handler_type & t)
+        {
+            auto & p = get_pacer(t.destination());
+            refill(p);
+            /* a fragment may be sent once there are enough tokens for the largest one */
+            return p.tokens >= static_cast<double>(_interface.max_data_size());
+        }
+
+        bool is_fragment_transmit_allowed()
+        {
+            return _interface.get_status().transmit_queue_level < _pacing.max_queued_fragments;
+        }
+
+        void bordering_fragment_response_received(const transfer_handler_type &, message_types) {}
+
+        void transfer_progressed(const transfer_handler_type & t)
+        {
+            /* the peer is keeping up, but barely, do not push it further */
+            auto peer = find_peer(t.destination());
+            if (peer != _peers.end() && peer->status.rx_poor())
+                return;
+
+            auto & p = get_pacer(t.destination());
+            if (within_round_trip(p.last_increase, p.addr) || within_round_trip(p.last_decrease, p.addr))
+                return;
+
+            p.last_increase = coarse_clock::now();
+            p.rate_before_increase = p.rate;
+            if (p.slow_start)
+                p.rate = std::min<bit_rate::unit_type>(p.rate * 2, _pacing.max_rate);
+            else
+                p.rate = std::min<bit_rate::unit_type>(p.rate + _pacing.rate_increase, _pacing.max_rate);
+        }
+
+        void transfer_loss_detected(const transfer_handler_type & t)
+        {
+            decrease(t.destination());
+        }
+
+        void data_fragment_transmitted(const transfer_handler_type & t, const fragment & f)
+        {
+            get_pacer(t.destination()).tokens -= static_cast<double>(f.data().size());
+        }
+
+        void peer_status_received(address_type addr, status_type status)
+        {
+            base::peer_status_received(addr, status);
+            if (status.rx_critical())
+                decrease(addr);
+        }
+
+        void decrease(address_type addr)
+        {
+            auto & p = get_pacer(addr);
+            if (within_round_trip(p.last_decrease, addr))
+                return;
+
+            /* the increase was based on a round trip that turned out to be lossy */
+            if (within_round_trip(p.last_increase, addr))
+                p.rate = p.rate_before_increase;
+            p.last_decrease = coarse_clock::now();
+            p.slow_start = false;
+            p.rate = std::max<bit_rate::unit_type>(static_cast<bit_rate::unit_type>(p.rate * _pacing.rate_decrease),
+                _pacing.min_rate);
+        }
+
+        /* true when less than the peer's smoothed round trip time has passed since the time point */
+        bool within_round_trip(clock::time_point since, address_type addr)
+        {
+            auto rtt = peer_rtt(addr);
+            auto period = rtt && rtt->has_samples() ? rtt->srtt() : _config.min_rto;
+            return since != never() && since + period > coarse_clock::now();
+        }
+
+        void refill(pacer_state & p)
+        {
+            auto now = coarse_clock::now();
+            auto elapsed = std::chrono::duration<double>(now - p.last_refill).count();
+            p.last_refill = now;
+            p.tokens = std::min(p.tokens + elapsed * p.rate / 8, static_cast<double>(_pacing.burst_size));
+        }
+
+        typename pacer_list_type::const_iterator find_pacer(address_type addr) const
+        {
+            return std::find_if(_pacers.begin(), _pacers.end(), [&](const pacer_state & ps){
+                return ps.addr == addr;
+            });
+        }
+
+        pacer_state & get_pacer(address_type addr)
+        {
+            auto p = std::find_if(_pacers.begin(), _pacers.end(), [&](const pacer_state & ps){
+                return ps.addr == addr;
+            });
+            if (p == _pacers.end())
+                return _pacers.emplace_front(addr, _pacing);
+            else
+                return *p;
+        }
+    };
+}
+
+#endif
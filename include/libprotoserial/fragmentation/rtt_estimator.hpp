@@ -0,0 +1,107 @@
+/*
+ * This file is a part of the libprotoserial project
+ * https://github.com/georges-circuits/libprotoserial
+ *
+ * Copyright (C) 2022 Jiří Maňák - All Rights Reserved
+ * For contact information visit https://manakjiri.eu/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/gpl.html>
+ */
+
+#ifndef _SP_FRAGMENTATION_RTT_ESTIMATOR
+#define _SP_FRAGMENTATION_RTT_ESTIMATOR
+
+#include "libprotoserial/clock.hpp"
+
+#include <algorithm>
+
+namespace sp
+{
+    /* Jacobson/Karels round trip time estimator (the one from RFC 6298)
+    srtt and rttvar are exponentially weighted averages of the samples and of their deviation,
+    the retransmit timeout is srtt + 4 * rttvar, doubled on every timeout until a new sample comes
+    the owner is responsible for not feeding samples of retransmitted fragments (Karn's algorithm) */
+    class rtt_estimator
+    {
+        public:
+        using duration = clock::duration;
+
+        rtt_estimator(duration initial_rto, duration min_rto, duration max_rto) :
+            _srtt(0), _rttvar(0), _initial(initial_rto), _min(min_rto), _max(max_rto) {}
+
+        void sample(duration rtt)
+        {
+            if (rtt < duration(0))
+                return;
+
+            if (_samples == 0)
+            {
+                _srtt = rtt;
+                _rttvar = rtt / 2;
+            }
+            else
+            {
+                auto err = rtt > _srtt ? rtt - _srtt : _srtt - rtt;
+                /* rttvar = 3/4 rttvar + 1/4 |srtt - rtt|, srtt = 7/8 srtt + 1/8 rtt */
+                _rttvar = _rttvar - _rttvar / 4 + err / 4;
+                _srtt = _srtt - _srtt / 8 + rtt / 8;
+            }
+            ++_samples;
+            _backoff = 0;
+        }
+
+        /* the retransmit timer expired, the timeout doubles */
+        void backoff()
+        {
+            /* the timeout is clamped by max anyway, this just prevents the shift from overflowing */
+            if (_backoff < 16)
+                ++_backoff;
+        }
+
+        /* the current retransmit timeout */
+        duration rto() const
+        {
+            return backed_off(_backoff);
+        }
+
+        /* how long would it take the sender to give up after retries timeouts in a row starting with
+        the current timeout */
+        duration give_up_time(uint retries) const
+        {
+            duration total(0);
+            for (uint i = 0; i <= retries; ++i)
+                total += backed_off(std::min<uint>(_backoff + i, 16));
+            return total;
+        }
+
+        inline bool has_samples() const {return _samples != 0;}
+        inline duration srtt() const {return _srtt;}
+        inline duration rttvar() const {return _rttvar;}
+
+        private:
+        duration base_rto() const
+        {
+            return _samples == 0 ? _initial : _srtt + 4 * _rttvar;
+        }
+        duration backed_off(uint backoff) const
+        {
+            return std::min(std::clamp(base_rto(), _min, _max) * (1 << backoff), _max);
+        }
+
+        duration _srtt, _rttvar, _initial, _min, _max;
+        uint _samples = 0, _backoff = 0;
+    };
+}
+
+#endif
@@ -27,6 +27,8 @@
 #include "libprotoserial/clock.hpp"
 #include "libprotoserial/fragmentation/id_factory.hpp"
 
+#include <algorithm>
+
 namespace sp
 {
     struct transfer_metadata : public fragment_metadata
@@ -35,12 +37,20 @@ namespace sp
         fragmentation_handler::id_type types
         the fragment id is used to uniquely identify a fragment transfer together with the destination and source
         addresses and the interface name. It is issued by the transmitting side of the fragment */
-        using id_type = uint8_t;
+        using id_type = uint16_t;
         /* index of a fragment within a transfer, starts with 1, index 0 signals invalid index */
-        using index_type = uint8_t;
+        using index_type = uint16_t;
+
+        /* traffic class of the transfer, it only matters to the sender, transfers of a higher class get 
+        a larger share of the link (see base_fragmentation_handler::configuration::priority_weights) */
+        using priority_type = uint8_t;
 
         static constexpr id_type invalid_id = 0; //FIXME should this be here?
         static constexpr index_type invalid_index = 0;
+        static constexpr priority_type priority_classes = 4;
+        /* the class of transfers that do not ask for any, 0 is meant for bulk data and 
+        priority_classes - 1 for small latency sensitive transfers such as control commands */
+        static constexpr priority_type default_priority = 1;
 
         transfer_metadata(address_type src, address_type dst, interface_identifier iid, 
             time_point timestamp_creation, id_type id, id_type prev_id) :
@@ -61,6 +71,12 @@ namespace sp
 
         constexpr id_type get_id() const {return _id;}
         constexpr id_type get_prev_id() const {return _prev_id;}
+        constexpr priority_type get_priority() const {return _priority;}
+
+        constexpr void set_priority(priority_type p) 
+        {
+            _priority = std::min<priority_type>(p, priority_classes - 1);
+        }
 
         void set_interface_id(interface_identifier iid)
         {
@@ -74,9 +90,12 @@ namespace sp
         transfer_metadata create_response_transfer_metadata() const
         {
             //TODO should this populate the interface and so forth?
-            return transfer_metadata(destination(), source(), interface_id(), 
-                clock::now(), global_id_factory.new_id(interface_id()), get_id()
+            /* the response belongs to the same traffic class */
+            transfer_metadata tm(destination(), source(), interface_id(), 
+                coarse_clock::now(), global_id_factory.new_id(interface_id()), get_id()
             );
+            tm.set_priority(get_priority());
+            return tm;
         }
 
         /* returns the fragment portion of the metadata */
@@ -99,6 +118,8 @@ namespace sp
             
             if (get_prev_id() != invalid_id)
                 os << ", prev: " << (int)get_prev_id();
+            if (get_priority() != default_priority)
+                os << ", prio: " << (int)get_priority();
             
             return os;
         }
@@ -106,6 +127,7 @@ namespace sp
 
         protected:
         id_type _id, _prev_id;
+        priority_type _priority = default_priority;
     };
 
     struct transfer : public transfer_metadata
@@ -137,6 +159,30 @@ namespace sp
         protected:
         data_type _data;
     };
+
+    /* a piece of an incoming transfer delivered before the rest of it has arrived, the chunks
+    of a transfer come in order and without gaps, the last one completes the transfer */
+    struct transfer_chunk : public transfer_metadata
+    {
+        using data_type = transfer::data_type;
+        using size_type = data_type::size_type;
+
+        transfer_chunk(transfer_metadata metadata, size_type offset, size_type transfer_size, data_type && data) :
+            transfer_metadata(std::move(metadata)), _offset(offset), _transfer_size(transfer_size), _data(std::move(data)) {}
+
+        /* position of the chunk within the transfer data */
+        constexpr size_type offset() const noexcept {return _offset;}
+        /* size of the data of the whole transfer */
+        constexpr size_type transfer_size() const noexcept {return _transfer_size;}
+        constexpr bool is_last() const noexcept {return _offset + _data.size() == _transfer_size;}
+
+        constexpr const data_type& data() const noexcept {return _data;}
+        constexpr data_type& data() noexcept {return _data;}
+
+        protected:
+        size_type _offset, _transfer_size;
+        data_type _data;
+    };
 }
 
 #ifdef SP_ENABLE_IOSTREAM
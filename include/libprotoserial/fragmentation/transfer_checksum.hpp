@@ -0,0 +1,102 @@
+/*
+ * This file is a part of the libprotoserial project
+ * https://github.com/georges-circuits/libprotoserial
+ *
+ * Copyright (C) 2022 Jiří Maňák - All Rights Reserved
+ * For contact information visit https://manakjiri.eu/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/gpl.html>
+ */
+
+#ifndef _SP_FRAGMENTATION_TRANSFER_CHECKSUM
+#define _SP_FRAGMENTATION_TRANSFER_CHECKSUM
+
+#include "libprotoserial/data/container.hpp"
+
+#include "etl/crc32.h"
+
+#include <array>
+#include <cstdint>
+
+namespace sp
+{
+    /* the CRC32 of a transfer, the fragments arrive in any order so each one is checksummed on its own as 
+    it is written and the checksums are then combined, appending zero bytes to the data of a CRC32 is 
+    a linear operator over GF(2), so the CRC32 of concatenated pieces follows from the CRC32s of the 
+    pieces and their sizes (as in zlib's crc32_combine()) */
+    class transfer_checksum
+    {
+        using matrix = std::array<std::uint32_t, 32>;
+
+        public:
+        using value_type = std::uint32_t;
+        static constexpr bytes::size_type size = sizeof(value_type);
+
+        static value_type compute(bytes::const_iterator begin, bytes::const_iterator end)
+        {
+            return etl::crc32(reinterpret_cast<const std::uint8_t*>(begin), 
+                reinterpret_cast<const std::uint8_t*>(end)).value();
+        }
+
+        /* prepares the combination with pieces of length bytes */
+        explicit transfer_checksum(bytes::size_type length)
+        {
+            /* a single zero bit, the reflected polynomial enters at the top */
+            matrix op;
+            op[0] = 0xedb88320;
+            for (uint i = 1; i < 32; ++i)
+                op[i] = std::uint32_t(1) << (i - 1);
+            op = square(square(square(op)));
+
+            for (uint i = 0; i < 32; ++i)
+                _shift[i] = std::uint32_t(1) << i;
+            for (; length != 0; length >>= 1, op = square(op))
+                if (length & 1)
+                    _shift = multiply(op, _shift);
+        }
+
+        /* the CRC32 of the data of first followed by the data of second, which must be length bytes long */
+        value_type combine(value_type first, value_type second) const
+        {
+            return times(_shift, first) ^ second;
+        }
+
+        private:
+        static std::uint32_t times(const matrix & m, std::uint32_t v)
+        {
+            std::uint32_t ret = 0;
+            for (uint i = 0; v != 0; ++i, v >>= 1)
+                if (v & 1)
+                    ret ^= m[i];
+            return ret;
+        }
+
+        static matrix multiply(const matrix & a, const matrix & b)
+        {
+            matrix ret;
+            for (uint i = 0; i < 32; ++i)
+                ret[i] = times(a, b[i]);
+            return ret;
+        }
+
+        static matrix square(const matrix & m)
+        {
+            return multiply(m, m);
+        }
+
+        matrix _shift;
+    };
+}
+
+#endif
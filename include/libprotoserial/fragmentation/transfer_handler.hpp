@@ -20,34 +20,78 @@
  */
 
 
+
 #ifndef _SP_FRAGMENTATION_TRANSFERHANDLER
 #define _SP_FRAGMENTATION_TRANSFERHANDLER
 
 #include <optional>
+#include <deque>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <limits>
+#include <cstdint>
+#include <type_traits>
 
 #include "libprotoserial/fragmentation/transfer.hpp"
+#include "libprotoserial/fragmentation/fragment_bitmap.hpp"
+#include "libprotoserial/fragmentation/transfer_checksum.hpp"
+#include "libprotoserial/interface/parsers.hpp"
 
 namespace sp
 {
     namespace detail
     {
         /* extends the functionality of the transfer object in order to handle 
-        transmit and receive operations in fragmentation_handler */
+        transmit and receive operations in fragmentation_handler 
+        
+        outgoing transfers implement the sender side of a selective-repeat sliding window, fragments 
+        are sent in order as long as there are fewer than window of them unacknowledged, the peer 
+        acknowledges them cumulatively (FRAGMENT_ACK carries the highest index up to which everything 
+        was received) and reports all missing ones at once (FRAGMENT_NACK), those are retransmitted first
+        
+        incoming transfers accept fragments in any order and keep track of what is missing
+        
+        FRAGMENT_NACK carries the index of the first missing fragment in the Header (everything before it 
+        was received) and a fragment_bitmap of the received fragments from that index up to the highest 
+        received one as data, every clear bit in it is a fragment to be retransmitted 
+        
+        the first fragment carries the size of the transfer (length_type) right after the Header, so the 
+        fragments split a stream made of the size followed by the transfer data, the receiver allocates 
+        the exact data() once the first (or the last) fragment tells it the size
+
+        with set_parity_block(), the outgoing transfer is split into blocks of that many fragments and a
+        FRAGMENT_PARITY follows the last fragment of each block, it is the XOR of the block's fragments (each
+        padded to the size of the first one), so the receiver can rebuild any single missing fragment of the
+        block without waiting for the retransmit 
+        
+        streamed incoming transfers do not allocate data(), the fragments are held only until everything before 
+        them was received, then they are handed over by take_chunks(), so the memory is bounded by the window 
+        of the peer, a copy of the last few handed over fragments is kept around for the parity rebuild 
+        
+        a checked transfer (FRAGMENT_CHECKED) appends the transfer_checksum of the size and the data to the 
+        stream, so it ends up in the last fragment. the receiver checksums every fragment as it stores it and 
+        verifies the combination once it has all of them, on a mismatch it asks for the fragments again a block 
+        at a time (FRAGMENT_RESEND) and stops as soon as a retransmitted fragment that differs from the copy 
+        it had makes the checksum match. streamed transfers are not verified, their chunks are handed over 
+        before the checksum arrives */
         template<typename Header>
         class transfer_handler : public transfer
         {
+            static_assert(sizeof(typename Header::index_type) <= sizeof(index_type) && 
+                sizeof(typename Header::id_type) <= sizeof(id_type), "the Header does not fit into the transfer");
+
             public:
             using header_type = Header;
             using message_types = typename header_type::message_types;
+            using status_type = typename header_type::status_type;
 
-            enum class state
-            {
-                NEW,
-                SENT,
-                NEXT,
-                WAITING,
-                RETRY
-            };
+            /* the transfer size in front of the data of the first fragment, it is twice as wide as the fragment 
+            index, so the 8 bit Headers of the small links spend 2 bytes on it and limit the transfer to 65535 bytes */
+            using length_type = std::conditional_t<sizeof(typename Header::index_type) == 1, std::uint16_t, std::uint32_t>;
+            static constexpr data_type::size_type length_size = sizeof(length_type);
 
             enum class purpose
             {
@@ -55,60 +99,79 @@ namespace sp
                 INCOMING
             };
 
-
-            /* receive constructor, f is the first fragment of the transfer (maximum fragment size is derived
-            from this fragment's size)
-            note that this cannot infer the actual size of the final transfer based on this fragment (unless this
-            is the last one as well), so a worst-case scenario is assumed (fragments_total * max_fragment_size) 
-            and the internal data() container will get resized in the put_fragment function when the last fragment 
-            is received */
-            transfer_handler(fragment f, const Header & h) : 
-                transfer(transfer_metadata(f, h.get_id(), h.get_prev_id()), std::move(f.data())), last_tx_time(never()), 
-                last_rx_time(clock::now()), max_fragment_size(0), fragments_total(h.fragments_total()), current_fragment(0),
-                transfer_state(state::NEXT), transfer_purpose(purpose::INCOMING)
-            {
-                /* reserve space for up to fragments_total fragments. There is no need to regard prealloc_size since this 
-                is the receive constructor. fragments_total is always >= 1, so this works for all cases, expand does nothing 
-                for arguments (0, 0) */
-                max_fragment_size = data().size();
-                data().expand(0, (fragments_total - 1) * max_fragment_size);
-                /* note that after the receive is done, the transfer's data will get resized using the bytes::shrink function,
-                this operation only decreases the size, but does not change capacity, so there is no copy overhead */
-                
-                fragment_status.reserve(fragments_total);
-                std::fill(fragment_status.begin(), fragment_status.end(), 0);
+            /* receive constructor, f is the first received fragment of the transfer at position pos, it can be 
+            any fragment but the last one, unless the transfer consists of a single fragment, because the maximum 
+            fragment size is derived from it (see can_start_with())
+            data() is allocated once the transfer size is known, that is when the first fragment (which carries 
+            the size) or the last one arrives, fragments received before that are held on their own
+            with stream, the transfer is streamed instead and history fragments are kept for the parity rebuild */
+            transfer_handler(fragment f, const Header & h, bool stream = false, index_type history = 0) : 
+                transfer(transfer_metadata(f, h.get_id(), h.get_prev_id()), data_type()), last_tx_time(never()), 
+                last_rx_time(coarse_clock::now()), max_fragment_size(f.data().size()), stream_size(0), 
+                fragments_total(h.fragments_total()), next_fragment(1), acknowledged(0), 
+                transfer_purpose(purpose::INCOMING), response_pending(false), streaming(stream), history_size(history)
+            {
+                checked = h.type() == message_types::FRAGMENT_CHECKED;
+                fragments.resize(fragments_total);
+                if (checked)
+                {
+                    fragment_checksums.resize(fragments_total);
+                    trailer = data_type(transfer_checksum::size);
+                }
+                put_fragment(h.fragment(), f);
             }
 
-            /* transmit constructor, max_fragment_size is the maximum fragment data size excluding the fragmentation header */
-            transfer_handler(transfer t, data_type::size_type max_fragment_data_size) : 
-                transfer(std::move(t)), last_tx_time(never()), last_rx_time(never()), max_fragment_size(max_fragment_data_size), 
-                fragments_total(0), current_fragment(0), transfer_state(state::NEW), transfer_purpose(purpose::OUTGOING)
+            /* transmit constructor, it runs in transmit() outside of the main_task so it takes the precise time, 
+            max_fragment_size is the maximum fragment data size excluding the fragmentation header,
+            with checksum, the transfer is sent as a checked one */
+            transfer_handler(transfer t, data_type::size_type max_fragment_data_size, bool checksum = false) : 
+                transfer(std::move(t)), last_tx_time(never()), last_rx_time(clock::now()), max_fragment_size(max_fragment_data_size), 
+                stream_size(data().size() + length_size), fragments_total(0), next_fragment(1), acknowledged(0), 
+                transfer_purpose(purpose::OUTGOING), response_pending(false)
             {
-                auto size = data().size();
+                checked = checksum;
+                stream_size += trailer_size();
                 /* calculate the fragments_total count correctly, ie. assume max = 4, then
-                for size = 2 -> total = 1
-                for size = 4 -> total = 1 
-                but for size = 5 -> total = 2 */
-                fragments_total = size / max_fragment_size + (size % max_fragment_size == 0 ? 0 : 1);
+                for stream_size = 2 -> total = 1
+                for stream_size = 4 -> total = 1 
+                but for stream_size = 5 -> total = 2 */
+                fragments_total = stream_size / max_fragment_size + (stream_size % max_fragment_size == 0 ? 0 : 1);
+
+                fragments.resize(fragments_total);
+                requested.resize(fragments_total);
+            }
 
-                fragment_status.reserve(fragments_total);
-                std::fill(fragment_status.begin(), fragment_status.end(), 0);
+            /* true if an incoming transfer can be started by this fragment, see the receive constructor */
+            static bool can_start_with(const fragment & f, const Header & h)
+            {
+                return f.data().size() > 0 && (h.fragment() < h.fragments_total() || h.fragments_total() == 1);
             }
 
-            /* returns the fragment's data size, this does not include the Header */
-            data_type::size_type fragment_size(index_type pos)
+            /* returns the fragment's data size, this does not include the Header but it does include the 
+            transfer size carried by the first fragment, the last fragment of an incoming transfer is assumed 
+            to be max_fragment_size long until the transfer size is known */
+            data_type::size_type fragment_size(index_type pos) const
             {
-                if (pos > fragments_total)
+                if (pos == 0 || pos > fragments_total)
                     return 0;
                 
                 auto start = (pos - 1) * max_fragment_size;
-                auto end = std::min(start + max_fragment_size, data().size());
+                auto end = std::min(start + max_fragment_size, is_size_known() ? stream_size : fragments_total * max_fragment_size);
                 return end - start;
             }
 
+            /* the number of fragments needed to carry a transfer of size bytes, each at most 
+            max_fragment_data_size long, trailer is the size of the checksum of checked transfers */
+            static data_type::size_type fragments_needed(data_type::size_type size, data_type::size_type max_fragment_data_size, 
+                data_type::size_type trailer = 0)
+            {
+                auto stream = size + length_size + trailer;
+                return stream / max_fragment_data_size + (stream % max_fragment_data_size == 0 ? 0 : 1);
+            }
+
             /* returns a fragment containing the correct metadata with data copied from pos of the transfer
-            and the templated fragmentation Header */
-            std::optional<fragment> get_fragment(index_type pos, const prealloc_size & alloc)
+            and the templated fragmentation Header, status is our receiver status to be advertised in the Header */
+            std::optional<fragment> get_fragment(index_type pos, const prealloc_size & alloc, status_type status = 0)
             {
                 if (!is_outgoing())
                     return std::nullopt;
@@ -117,112 +180,468 @@ namespace sp
                 if (data_size == 0)
                     return std::nullopt;
 
-                if (!prepare_for_transmit())
-                    return std::nullopt;
-
-                /* we are getting a fragment which is to be transmitted, increments its counter */
-                increment_fragment_status(pos);
-                
-                /* allocate the container using the prealloc_size class, add additional space for 
-                the fragmentation Header */
-                auto data = alloc.create(sizeof(Header), data_size, 0);
-                auto start = fragment_data_begin(pos);
-                
-                /* copy the data from the internal data buffer */
-                std::copy(start, start + data_size, data.begin());
+                prepare_wire(alloc);
+                data_type data;
+                auto & lent = lent_fragments.at(pos - 1);
+                if (lent.expired())
+                {
+                    /* the fragment is emitted as a view into the wire buffer, the token keeps the buffer alive 
+                    for as long as the lower layers hold the fragment, even past the lifetime of this transfer */
+                    std::shared_ptr<void> token(wire.get(), [keep = wire](void *){});
+                    lent = token;
+                    if (wire_stride == 0)
+                        data = data_type::view(std::move(token), wire->get_base(), wire->capacity_front(), 
+                            data_size, wire->capacity_back());
+                    else
+                        data = data_type::view(std::move(token), wire->get_base() + (pos - 1) * wire_stride, 
+                            wire_front, data_size, wire_stride - wire_front - data_size);
+                }
+                else
+                {
+                    /* the previous emission of this fragment is still queued somewhere, the view would have 
+                    its headers overwritten, copy instead */
+                    data = alloc.create(sizeof(Header), data_size, 0);
+                    auto start = wire_fragment_begin(pos);
+                    std::copy(start, start + data_size, data.begin());
+                }
 
-                /* copy the header */
-                Header h = create_header(message_types::FRAGMENT, current_fragment);
-                data.push_front(to_bytes(h));
+                /* the header goes into the reserved space in front of the data */
+                Header h = create_header(checked ? message_types::FRAGMENT_CHECKED : message_types::FRAGMENT, pos, status);
+                data.expand(sizeof(Header), 0);
+                std::copy(reinterpret_cast<const byte*>(&h), reinterpret_cast<const byte*>(&h) + sizeof(Header), data.begin());
 
                 fragment ret(std::move(get_fragment_metadata()), std::move(data));
                 transmitted_fragment_id = ret.object_id();
+                last_tx_time = coarse_clock::now();
                 
                 return ret;
             }
 
-            /* returns the current fragment containing the correct metadata with data copied 
-            from the transfer and the templated fragmentation Header */
-            inline std::optional<fragment> get_current_fragment(const prealloc_size & alloc)
+            /* for outgoing transfers, returns the next fragment to be transmitted, requested retransmits 
+            go first, then the new fragments as long as the window permits */
+            std::optional<fragment> get_next_fragment(index_type window, const prealloc_size & alloc, status_type status = 0)
             {
-                return get_fragment(current_fragment, alloc);
+                if (!is_transmit_ready(window))
+                    return std::nullopt;
+
+                /* the parity goes right after its block, the blocks the peer already has are skipped */
+                while (!pending_parity.empty())
+                {
+                    auto first = pending_parity.front();
+                    pending_parity.pop_front();
+                    if (auto ret = get_parity_fragment(first, alloc, status))
+                        return ret;
+                }
+
+                /* drop the retransmits the peer has selectively acknowledged in the meantime */
+                while (!retransmits.empty() && fragments.test(retransmits.front() - 1))
+                    retransmits.pop_front();
+
+                index_type pos;
+                bool retransmit = !retransmits.empty();
+                if (retransmit)
+                {
+                    pos = retransmits.front();
+                    retransmits.pop_front();
+                }
+                else if (next_fragment <= fragments_total && in_flight() < window)
+                    pos = next_fragment++;
+                else
+                    return std::nullopt;
+
+                auto ret = get_fragment(pos, alloc, status);
+                /* one fragment per round trip is timed, the timing is ambiguous once anything got retransmitted 
+                (Karn's algorithm), the cumulative ACK of the timed fragment then waits for the retransmit, the 
+                start is refined when the interface actually begins the transmission */
+                if (retransmit)
+                    timed_pos = invalid_index;
+                else if (!retransmit && ret && timed_pos == invalid_index)
+                {
+                    timed_pos = pos;
+                    timed_fragment_id = ret->object_id();
+                    timed_start = clock::now();
+                }
+                if (!retransmit && ret && parity_block != 0 && (pos % parity_block == 0 || pos == fragments_total))
+                    pending_parity.push_back(pos - (pos - 1) % parity_block);
+                return ret;
             }
 
-            std::optional<fragment> get_ack_fragment(const prealloc_size & alloc)
+            /* for outgoing transfers, returns the FRAGMENT_PARITY of the block starting at first, nothing
+            when the peer already has the whole block */
+            std::optional<fragment> get_parity_fragment(index_type first, const prealloc_size & alloc, status_type status = 0)
             {
-                if (!is_incoming() || transfer_state != state::NEXT)
+                auto count = block_size(first);
+                if (!is_outgoing() || count == 0 || is_block_received(first, count))
                     return std::nullopt;
 
-                if (current_fragment == 0 || current_fragment > fragments_total)
+                prepare_wire(alloc);
+                auto data = alloc.create(sizeof(Header), fragment_size(first), 0);
+                std::fill(data.begin(), data.end(), byte(0));
+                for (index_type pos = first; pos < first + count; ++pos)
+                {
+                    auto start = wire_fragment_begin(pos);
+                    std::transform(start, start + fragment_size(pos), data.begin(), data.begin(), std::bit_xor<byte>());
+                }
+
+                /* the count of the fragments takes the place of prev_id, see message_types */
+                data.push_front(to_bytes(Header(message_types::FRAGMENT_PARITY, first, fragments_total, get_id(),
+                    static_cast<typename Header::id_type>(count), status)));
+                last_tx_time = coarse_clock::now();
+                return fragment(get_fragment_metadata(), std::move(data));
+            }
+
+            /* for outgoing transfers, a FRAGMENT_PARITY is sent after every block fragments, 0 disables that,
+            the block size can only be changed before the first fragment is transmitted, returns false otherwise */
+            bool set_parity_block(index_type block)
+            {
+                if (!is_outgoing() || next_fragment != 1)
+                    return false;
+                parity_block = std::min<index_type>(block, std::numeric_limits<typename Header::id_type>::max());
+                return true;
+            }
+
+            inline auto get_parity_block() const
+            {
+                return parity_block;
+            }
+
+            /* for incoming transfers, returns the response to the peer (or nothing if there is none pending),
+            that is a FRAGMENT_NACK listing all missing fragments when there is a gap before the last received 
+            fragment and a cumulative FRAGMENT_ACK otherwise */
+            std::optional<fragment> get_response_fragment(const prealloc_size & alloc, status_type status = 0)
+            {
+                if (!is_incoming() || !response_pending)
                     return std::nullopt;
 
-                auto data = alloc.create(sizeof(Header), 0, 0);
+                response_sent();
+                auto missing = first_missing();
+                auto highest = highest_received();
+                if (is_resending())
+                {
+                    /* the count of the fragments takes the place of prev_id, see message_types */
+                    auto data = alloc.create(sizeof(Header), 0, 0);
+                    data.push_front(to_bytes(Header(message_types::FRAGMENT_RESEND, missing, fragments_total, get_id(), 
+                        static_cast<typename Header::id_type>(resend_end - acknowledged), status)));
+                    last_tx_time = coarse_clock::now();
+                    return fragment(create_response_fragment_metadata(), std::move(data));
+                }
+                else if (has_gap())
+                {
+                    /* the bitmap must fit into a fragment the peer is able to receive */
+                    auto bits = std::min<data_type::size_type>(highest - missing + 1, max_fragment_size * 8);
+                    auto data = alloc.create(sizeof(Header), fragment_bitmap::bytes_for(bits), 0);
+                    fragments.copy_to(missing - 1, bits, data.begin());
+                    data.push_front(to_bytes(create_header(message_types::FRAGMENT_NACK, missing, status)));
+                    last_tx_time = coarse_clock::now();
+                    return fragment(create_response_fragment_metadata(), std::move(data));
+                }
+                else
+                    return create_response(message_types::FRAGMENT_ACK, acknowledged, alloc, status);
+            }
 
-                Header h = create_header(message_types::ACK, current_fragment);
-                data.push_front(to_bytes(h));
-                
-                fragment ret(std::move(get_fragment_metadata()), std::move(data));
-                
-                transmitted_fragment_id = ret.object_id();
-                transfer_state = state::WAITING;
+            /* for incoming transfers, the pending response as a Header if it is a FRAGMENT_ACK, those carry no 
+            data so they can be sent along with other messages to the peer, nothing if there is no response 
+            pending or it is a FRAGMENT_NACK */
+            std::optional<Header> get_response_ack(status_type status = 0)
+            {
+                if (!is_incoming() || !response_pending || has_gap() || is_resending())
+                    return std::nullopt;
 
-                return ret;
+                response_sent();
+                last_tx_time = coarse_clock::now();
+                return create_header(message_types::FRAGMENT_ACK, acknowledged, status);
+            }
+
+            /* for incoming transfers, true when the pending response should not wait any longer, that is after 
+            delay since the first fragment it covers was received, after every fragments, when there is a gap 
+            to be reported or when the peer seems to be retransmitting */
+            bool is_response_due(clock::duration delay, index_type every) const
+            {
+                return response_pending && (response_urgent || has_gap() || received_since_response >= every || 
+                    response_since + delay <= coarse_clock::now());
             }
 
             /* this function assumes that this was created using the receive constructor, it only 
-            concerns itself with the fragment's data, not its metadata. */
+            concerns itself with the fragment's data, not its metadata. returns false for fragments 
+            which do not fit and for duplicates, which should be acknowledged nevertheless */
             bool put_fragment(index_type pos, const fragment & f)
             {
-                if (!is_incoming())
+                if (!put_fragment_data(pos, f.data()))
                     return false;
+                rebuild_from_parity();
+                return true;
+            }
 
-                auto expected_max_size = fragment_size(pos);
-                if (expected_max_size == 0 || f.data().size() > expected_max_size)
+            /* for incoming transfers, stores the FRAGMENT_PARITY of count fragments starting at first, returns 
+            false when it does not fit, missing fragments are rebuilt from it as soon as there is one left 
+            in its block */
+            bool put_parity(index_type first, index_type count, const fragment & f)
+            {
+                /* the parity is as long as the first fragment of its block, that is the last fragment 
+                of the transfer in a block of its own, which may be shorter until the size is known */
+                if (!is_incoming() || first == 0 || count == 0 || first + count - 1 > fragments_total ||
+                    f.data().size() == 0 || f.data().size() > fragment_size(first) || 
+                    ((first != fragments_total || is_size_known()) && f.data().size() != fragment_size(first)))
                     return false;
-            
-                auto start = fragment_data_begin(pos);
-                std::copy(f.data().begin(), f.data().end(), start);
+
+                last_rx_time = coarse_clock::now();
+                if (is_block_received(first, count))
+                    return true;
                 
-                /* we have inserted fragment at pos, increment its counter */
-                increment_fragment_status(pos);
-                current_fragment = pos;
+                parities.push_back(parity{first, count, f.data()});
+                rebuild_from_parity();
+                return true;
+            }
 
-                /* resize the data() so it reflects the actual size now that we have received
-                the last fragment, more on that in the receive constructor comment */
-                if (pos == fragments_total)
-                    data().shrink(0, expected_max_size - f.data().size());
+            /* for streamed incoming transfers, calls f(offset, data) for the data from every fragment that has 
+            everything before it received and that was not handed over yet, offset is its position in the 
+            transfer data */
+            template<typename F>
+            void take_chunks(F f)
+            {
+                if (!streaming || !is_size_known())
+                    return;
 
-                return true;
+                while (streamed < acknowledged)
+                {
+                    auto pos = ++streamed;
+                    auto e = std::find_if(early_fragments.begin(), early_fragments.end(), [pos](const auto & ef){
+                        return ef.first == pos;
+                    });
+                    /* everything up to acknowledged should still be waiting here, if a parity rebuild or a checksum 
+                    reset took the fragment away, stop and try again once it is received again */
+                    if (e == early_fragments.end())
+                    {
+                        streamed = pos - 1;
+                        break;
+                    }
+                    data_type d = std::move(e->second);
+                    early_fragments.erase(e);
+
+                    /* the checksum trailer is not a part of the data */
+                    auto start = (pos - 1) * max_fragment_size, data_end = stream_size - trailer_size();
+                    auto skip = pos == 1 ? length_size : 0;
+                    auto size = start < data_end ? std::min(d.size(), data_end - start) : skip;
+                    data_type chunk(size - skip);
+                    std::copy(d.begin() + skip, d.begin() + size, chunk.begin());
+                    if (history_size != 0)
+                    {
+                        if (history.size() == history_size)
+                            history.pop_front();
+                        history.emplace_back(pos, std::move(d));
+                    }
+                    f((pos - 1) * max_fragment_size + skip - length_size, std::move(chunk));
+                }
+            }
+
+            inline bool is_streaming() const
+            {
+                return streaming;
             }
 
+            /* for incoming transfers, the size of the transfer data, 0 while it is not known */
+            inline data_type::size_type get_transfer_size() const
+            {
+                return is_size_known() ? stream_size - length_size - trailer_size() : 0;
+            }
+
+            /* for incoming transfers, the number of fragments rebuilt from FRAGMENT_PARITY */
+            inline auto get_rebuilt_count() const
+            {
+                return rebuilt;
+            }
+
+            inline bool is_checked() const
+            {
+                return checked;
+            }
+
+            /* for incoming transfers, the checksum of a checked transfer did not match and the peer 
+            was asked to send the fragments from first again, in blocks of block fragments, 0 resends 
+            all of them at once */
+            void set_resend_block(index_type block)
+            {
+                resend_block = block;
+            }
+
+            /* for incoming transfers, true while the fragments of a block are being sent again */
+            inline bool is_resending() const
+            {
+                return resend_end != 0 && acknowledged < resend_end;
+            }
+
+            /* for incoming transfers, the checksum did not match even after all the fragments were 
+            sent again, the transfer cannot be completed */
+            inline bool is_checksum_failed() const
+            {
+                return checksum_failed;
+            }
+
+            /* for outgoing transfers, the peer asks for the fragment at pos, returns false when the 
+            request does not make sense or the fragment was already requested since the last timeout,
+            repeated requests for the same gap would otherwise cause repeated retransmits */
             bool retransmit_request(index_type pos)
             {
-                /* the retransmit request can only come after we have transmitted the final
-                fragment of the transfer. Something is wrong if it comes sooner */
-                if (transfer_state != state::SENT || current_fragment != fragments_total)
+                if (!is_outgoing() || pos <= acknowledged || pos >= next_fragment || fragments.test(pos - 1))
                     return false;
 
-                if (pos > fragments_total)
+                last_rx_time = coarse_clock::now();
+                if (requested.test(pos - 1))
                     return false;
 
-                /* set the internal state according to docs */
-                transfer_state = state::RETRY;
-                current_fragment = pos;
+                requested.set(pos - 1);
+                retransmits.push_back(pos);
+                return true;
+            }
+
+            /* for outgoing transfers, the peer could not verify the checksum and asks for count fragments 
+            from first again, it does not have them anymore even though it may have acknowledged them, 
+            returns the number of fragments queued for retransmission */
+            index_type resend_request(index_type first, index_type count)
+            {
+                if (!is_outgoing() || !checked || first == 0 || count == 0 || first + count - 1 > fragments_total || 
+                    first + count - 1 >= next_fragment)
+                    return 0;
+
+                last_rx_time = coarse_clock::now();
+                retries = 0;
+                if (first - 1 < acknowledged)
+                    acknowledged = first - 1;
+                else
+                    acknowledge(first - 1);
+                timed_pos = invalid_index;
+
+                /* the requests repeat until the block arrives, the fragments which are already 
+                queued or sent again since the last timeout are left alone */
+                index_type queued = 0;
+                for (index_type pos = first; pos < first + count; ++pos)
+                {
+                    if (fragments.test(pos - 1))
+                    {
+                        fragments.reset(pos - 1);
+                        requested.reset(pos - 1);
+                    }
+                    if (retransmit_request(pos))
+                        ++queued;
+                }
+                return queued;
+            }
+
+            /* for outgoing transfers, handles the FRAGMENT_NACK data, pos is the first missing fragment 
+            from the Header, everything before it is acknowledged, returns the number of fragments queued 
+            for retransmission */
+            index_type negative_acknowledge(index_type pos, const bytes & bitmap)
+            {
+                if (!is_outgoing() || pos == 0)
+                    return 0;
+
+                acknowledge(pos - 1);
                 
+                /* only the fragments below the highest received one are known to be missing, 
+                the rest may still be on their way */
+                index_type queued = 0, highest = 0;
+                for (fragment_bitmap::size_type i = 0; i < bitmap.size() * 8 && pos + i < next_fragment; ++i)
+                    if (fragment_bitmap::test(bitmap, i))
+                        highest = pos + i;
+                
+                for (index_type i = pos; i < highest; ++i)
+                {
+                    if (fragment_bitmap::test(bitmap, i - pos))
+                        fragments.set(i - 1);
+                    else if (retransmit_request(i))
+                        ++queued;
+                }
+                if (highest != 0)
+                    fragments.set(highest - 1);
+                return queued;
+            }
+
+            /* for outgoing transfers, the peer has received everything up to and including pos,
+            returns true if this moved the window */
+            bool acknowledge(index_type pos)
+            {
+                if (!is_outgoing() || pos > fragments_total || pos >= next_fragment)
+                    return false;
+
+                /* the peer is alive even if this did not move the window */
+                last_rx_time = coarse_clock::now();
+                retries = 0;
+                if (pos <= acknowledged)
+                    return false;
+
+                acknowledged = pos;
+                last_progress_time = last_rx_time;
+                if (timed_pos != invalid_index && pos >= timed_pos)
+                {
+                    rtt_sample = clock::now() - timed_start;
+                    timed_pos = invalid_index;
+                }
+                for (index_type i = 0; i < pos; ++i)
+                    fragments.set(i);
+                retransmits.erase(std::remove_if(retransmits.begin(), retransmits.end(), 
+                    [pos](index_type i){return i <= pos;}), retransmits.end());
                 return true;
             }
 
+            /* for outgoing transfers, returns the round trip time measured by the last acknowledge() 
+            call, if there is one, each sample is returned only once */
+            std::optional<clock::duration> take_rtt_sample()
+            {
+                auto ret = rtt_sample;
+                rtt_sample.reset();
+                return ret;
+            }
+
+            /* for outgoing transfers, nothing came from the peer for too long, retransmit the oldest 
+            unacknowledged fragment, the peer will respond with its view of the transfer */
+            bool retransmit_oldest()
+            {
+                /* nothing to do when the previous retransmit did not even go out yet */
+                if (!is_outgoing() || acknowledged + 1 >= next_fragment || !retransmits.empty())
+                    return false;
+
+                /* the peer may have lost our retransmits, allow the requests again */
+                requested.clear();
+                requested.set(acknowledged);
+                retransmits.push_back(acknowledged + 1);
+                ++retries;
+                return true;
+            }
+
+            /* for incoming transfers, moves the received transfer out */
+            transfer take_transfer()
+            {
+                return transfer(transfer_metadata(*this), std::move(data()));
+            }
+
+            /* for incoming transfers, ask the peer again about the state of the transfer */
+            void request_response()
+            {
+                set_response_pending();
+                response_urgent = true;
+            }
+
             /* call this when the interface acknowledges the transmission of sent fragment */
-            bool fragment_transmitted()
+            bool fragment_transmitted(object_id_type id)
             {
-                if (is_fragment_transmitted())
+                bool ret = false;
+                if (timed_pos != invalid_index && timed_fragment_id == id)
                 {
-                    transfer_state = state::SENT;
-                    last_tx_time = clock::now();
-
-                    return true;
+                    timed_start = clock::now();
+                    ret = true;
+                }
+                if (transmitted_fragment_id == id)
+                {
+                    last_tx_time = coarse_clock::now();
+                    ret = true;
                 }
-                return false;
+                return ret;
+            }
+
+            /* IDs of the transmitted fragments fragment_transmitted() is waiting for, 0 for none */
+            std::array<object_id_type, 2> get_indexed_fragment_ids() const
+            {
+                return {transmitted_fragment_id, timed_pos != invalid_index ? timed_fragment_id : 0};
             }
 
             bool is_incoming() const
@@ -261,118 +680,520 @@ namespace sp
                 return is_request_of(f, h);
             }
 
-            inline bool is_current_first() const
+            /* for outgoing transfers, check if a fragment of this should be transmitted given the window size */
+            inline bool is_transmit_ready(index_type window) const
             {
-                return current_fragment == 1;
+                return is_outgoing() && (!retransmits.empty() || !pending_parity.empty() || 
+                    (next_fragment <= fragments_total && in_flight() < window));
             }
 
-            inline bool is_current_last() const
+            /* for outgoing transfers, true if the peer asked for some fragments which were not retransmitted yet */
+            inline bool has_pending_retransmits() const
             {
-                return current_fragment == fragments_total;
+                return !retransmits.empty();
             }
 
-            inline bool is_current_bordering() const
+            /* for outgoing transfers, number of fragments sent but not yet acknowledged */
+            inline index_type in_flight() const
             {
-                return is_current_first() || is_current_last();
+                return next_fragment - 1 - acknowledged;
             }
 
-            inline bool is_current_main() const
+            /* for incoming transfers, true if a response should be transmitted */
+            inline bool is_response_pending() const
             {
-                return current_fragment > 1 && current_fragment < fragments_total;
+                return response_pending;
             }
 
-            /* for outgoing transfers, check if a fragment of this should be transmitted */
-            inline bool is_transmit_ready() const
+            /* for outgoing transfers, the peer has acknowledged everything, for incoming 
+            transfers everything was received and verified */
+            inline bool is_complete() const
             {
-                return transfer_state == state::NEW || transfer_state == state::NEXT || transfer_state == state::RETRY;
+                return acknowledged == fragments_total && !checksum_failed;
             }
 
-            /* for outgoing and incoming transfers, true after a successful call 
-            of get_fragment(), get_current_fragment() or get_ack_fragment() */
-            inline bool is_fragment_transmitted() const
+            /* for incoming transfers, index of the first fragment not received yet, 0 when complete */
+            index_type first_missing() const
             {
-                return transfer_state == state::WAITING;
+                return is_complete() ? 0 : acknowledged + 1;
             }
 
-            /* for outgoing transfers, check if the transmit confirmation from interface belongs to this transfer */
-            inline bool is_fragment_transmitted_of(object_id_type id) const
+            /* for incoming transfers, true if a fragment after the first missing one was received */
+            inline bool has_gap() const
             {
-                return is_fragment_transmitted() && transmitted_fragment_id == id;
+                /* there is always a gap when acknowledged == 0 since we hold at least one fragment */
+                auto missing = first_missing();
+                return missing != 0 && missing < highest_received();
             }
-            
-            /* for incoming transfers, check if a fragment ACK should be transmitted this transfer,
-            this should also be combined with some transmit hold-off */
-            inline bool is_ack_ready() const
+
+            /* for incoming transfers, the highest fragment index received so far */
+            index_type highest_received() const
+            {
+                auto pos = fragments.find_last_set();
+                return pos == fragment_bitmap::npos ? 0 : pos + 1;
+            }
+
+            /* true if the fragment at pos was received (incoming) or is known to be received by the peer (outgoing) */
+            inline bool is_fragment_received(index_type pos) const
             {
-                return is_current_bordering() && transfer_state == state::NEXT;
+                return pos != 0 && fragments.test(pos - 1);
             }
 
+            /* for incoming transfers, the number of unique fragments received */
+            inline auto get_received_count() const
+            {
+                return static_cast<index_type>(fragments.count());
+            }
 
-            /* fragment_transmitted() update this time */
+            /* get_fragment() and fragment_transmitted() update this time */
             inline auto get_last_tx_time() const
             {
                 return last_tx_time;
             }
 
-            /* put_fragment() update this time */
+            /* anything received from the peer regarding this transfer updates this time */
             inline auto get_last_rx_time() const
             {
                 return last_rx_time;
             }
 
+            /* for outgoing transfers, the last time the window moved, responses which do not move it do not 
+            count since the peer cannot tell us about fragments it does not know about */
+            inline auto get_last_progress_time() const
+            {
+                return last_progress_time;
+            }
+
             inline auto get_max_fragment_data_size() const
             {
                 return max_fragment_size;
             }
 
+            /* for incoming transfers, true once data() is allocated to the size of the transfer */
+            inline bool is_size_known() const
+            {
+                return stream_size != 0;
+            }
+
             inline auto get_fragments_total() const
             {
                 return fragments_total;
             }
 
+            inline auto get_acknowledged() const
+            {
+                return acknowledged;
+            }
+
+            /* for outgoing transfers, number of retransmit_oldest() calls since the last response from the peer */
+            inline auto get_retries() const
+            {
+                return retries;
+            }
+
             protected:
-            /* this vector holds some status information about the fragments this transfer is made out of
-            - INCOMING: counts how many times a certain fragment was received
-            - OUTGOING: counts how many times a certain fragment was transmitted */
-            std::vector<uint> fragment_status;
+            /* one bit per fragment of this transfer
+            - INCOMING: the fragment was received
+            - OUTGOING: the peer has the fragment, either acknowledged cumulatively or selectively by FRAGMENT_NACK */
+            fragment_bitmap fragments;
+            /* OUTGOING: fragments queued for retransmission since the last timeout */
+            fragment_bitmap requested;
+            /* fragments requested by the peer, these are transmitted before any new ones */
+            std::deque<index_type> retransmits;
             /* timestamp of the last transmit/receive */
-            clock::time_point last_tx_time, last_rx_time;
+            clock::time_point last_tx_time, last_rx_time, last_progress_time = never();
             /* maximum fragment data size excluding the fragmentation header,
-            max_fragment_size * fragments_total >= data().size() should always hold */
+            max_fragment_size * fragments_total >= stream_size should always hold */
             data_type::size_type max_fragment_size;
-            /* max_fragment_size * fragments_total >= data().size() should always hold */
+            /* size of the data() plus the transfer size carried by the first fragment, 
+            INCOMING: 0 while the size of the transfer is not known */
+            data_type::size_type stream_size;
+            /* max_fragment_size * fragments_total >= stream_size should always hold */
             index_type fragments_total;
-            /* index of the fragment to be transmitted, 0 is invalid, ranges from 1 to fragments_total */
-            index_type current_fragment;
-            /* state of the transmission/reception process */
-            state transfer_state;
+            /* OUTGOING: index of the next new fragment to be transmitted, ranges from 1 to fragments_total + 1 */
+            index_type next_fragment;
+            /* all fragments up to and including this index were received (by the peer for outgoing transfers), 
+            0 means none */
+            index_type acknowledged;
             purpose transfer_purpose;
-            object_id_type transmitted_fragment_id;
+            /* INCOMING: something was received since the last response */
+            bool response_pending;
+            /* INCOMING: the pending response should go out right away, see is_response_due() */
+            bool response_urgent = false;
+            /* INCOMING: when the response became pending and how many fragments it covers */
+            clock::time_point response_since = never();
+            index_type received_since_response = 0;
+            /* OUTGOING: timeouts without a response */
+            uint retries = 0;
+            object_id_type transmitted_fragment_id = 0;
+            /* OUTGOING: the fragment being timed for the round trip time measurement, it uses clock::now(), 
+            the coarse_clock would quantize the samples to the main_task period */
+            index_type timed_pos = invalid_index;
+            object_id_type timed_fragment_id = 0;
+            clock::time_point timed_start = never();
+            std::optional<clock::duration> rtt_sample;
+            /* INCOMING: fragments received before the transfer size was known, 
+            for streamed transfers the ones which were not handed over yet */
+            std::vector<std::pair<index_type, data_type>> early_fragments;
+            /* INCOMING: see take_chunks(), streamed is the number of fragments handed over so far, history 
+            holds copies of the last history_size of them */
+            bool streaming = false;
+            index_type streamed = 0, history_size = 0;
+            std::deque<std::pair<index_type, data_type>> history;
+            /* the transfer is a checked one, see transfer_checksum */
+            bool checked = false;
+            /* INCOMING: the checksums of the received fragments without their trailer parts, the trailer
+            itself and the range of the fragments being sent again, see verify_checksum() */
+            std::vector<transfer_checksum::value_type> fragment_checksums;
+            data_type trailer;
+            index_type resend_block = 0, resend_first = 0, resend_end = 0;
+            bool checksum_failed = false;
+            /* OUTGOING: the data with room for the headers, see prepare_wire() */
+            std::shared_ptr<data_type> wire;
+            data_type::size_type wire_front = 0, wire_stride = 0;
+            /* OUTGOING: tokens of the fragments emitted as views, alive while the lower layers hold them */
+            std::vector<std::weak_ptr<void>> lent_fragments;
+            /* OUTGOING: fragments per FRAGMENT_PARITY, 0 for none, and the first fragments of the blocks 
+            whose parity is yet to be transmitted */
+            index_type parity_block = 0;
+            std::deque<index_type> pending_parity;
+            /* INCOMING: the parities of the blocks which are not complete yet */
+            struct parity
+            {
+                index_type first, count;
+                data_type data;
+            };
+            std::vector<parity> parities;
+            index_type rebuilt = 0;
             
-            inline data_type::iterator fragment_data_begin(index_type pos)
+            inline void set_response_pending()
+            {
+                if (!response_pending)
+                    response_since = coarse_clock::now();
+                response_pending = true;
+            }
+            inline void response_sent()
             {
-                return data().begin() + ((pos - 1) * max_fragment_size);
+                response_pending = false;
+                response_urgent = false;
+                received_since_response = 0;
             }
-            inline void increment_fragment_status(index_type pos)
+            /* true if all the count fragments from first were received (by the peer for outgoing transfers) */
+            inline bool is_block_received(index_type first, index_type count) const
             {
-                fragment_status.at(pos - 1) += 1;
+                auto missing = fragments.find_first_clear(first - 1);
+                return missing == fragment_bitmap::npos || missing >= static_cast<fragment_bitmap::size_type>(first - 1 + count);
             }
-            inline Header create_header(message_types type, index_type pos) const
+            /* OUTGOING: the number of fragments in the parity block starting at first */
+            inline index_type block_size(index_type first) const
             {
-                return Header(type, pos, fragments_total, get_id(), get_prev_id(), 0);
+                return parity_block == 0 || first == 0 || first > fragments_total ? 0 : 
+                    std::min<index_type>(parity_block, fragments_total - first + 1);
             }
-            /* if this returns true, get the current fragment and transmit it */
-            bool prepare_for_transmit()
+            inline data_type::iterator wire_fragment_begin(index_type pos)
             {
-                if (is_transmit_ready())
+                return wire_stride == 0 ? wire->begin() : wire->get_base() + (pos - 1) * wire_stride + wire_front;
+            }
+            /* INCOMING: see put_fragment() */
+            bool put_fragment_data(index_type pos, const data_type & d)
+            {
+                if (!is_incoming())
+                    return false;
+
+                last_rx_time = coarse_clock::now();
+                set_response_pending();
+
+                /* all fragments but the last must be max_fragment_size long, the last one exactly 
+                as long as the transfer size says once it is known */
+                auto size = d.size();
+                auto expected_max_size = fragment_size(pos);
+                if (expected_max_size == 0 || size > expected_max_size || size == 0 || 
+                    ((pos != fragments_total || is_size_known()) && size != expected_max_size) || 
+                    (pos == 1 && size < length_size))
+                    return false;
+
+                /* the peer would not retransmit if it had our response */
+                if (fragments.test(pos - 1))
+                {
+                    response_urgent = true;
+                    return false;
+                }
+
+                /* the first fragment carries the size, the last one implies it */
+                if (pos == 1 || (pos == fragments_total && !is_size_known()))
+                {
+                    auto stream = pos == 1 ? parsers::byte_copy<length_type>(d.begin()) + length_size + trailer_size() :
+                        (pos - 1) * max_fragment_size + size;
+                    if ((pos == fragments_total && stream != (pos - 1) * max_fragment_size + size) || 
+                        (is_size_known() ? stream != stream_size : !set_stream_size(stream)))
+                        return false;
+                }
+
+                bool changed = false;
+                if (is_size_known() && !streaming)
+                    changed = store_fragment(pos, d);
+                else
+                    early_fragments.emplace_back(pos, d);
+                
+                fragments.set(pos - 1);
+                auto next = fragments.find_first_clear(acknowledged);
+                acknowledged = next == fragment_bitmap::npos ? fragments_total : next;
+                ++received_since_response;
+
+                if (checked && !streaming)
+                    verify_checksum(changed);
+                return true;
+            }
+            /* INCOMING: verifies the checksum once all the fragments are received, or sooner while they are being 
+            sent again and one of them changed, moves on to the next block to be sent again on a mismatch */
+            void verify_checksum(bool changed)
+            {
+                if (acknowledged != fragments_total && !(changed && resend_end != 0))
+                    return;
+
+                if (stream_checksum() == parsers::byte_copy<transfer_checksum::value_type>(trailer.begin()))
+                {
+                    for (index_type pos = resend_first; pos <= resend_end; ++pos)
+                        fragments.set(pos - 1);
+                    acknowledged = fragments_total;
+                    resend_first = resend_end = 0;
+                    return;
+                }
+                if (acknowledged != fragments_total)
+                    return;
+                if (resend_end == fragments_total)
+                {
+                    checksum_failed = true;
+                    return;
+                }
+
+                resend_first = resend_end + 1;
+                resend_end = resend_block == 0 ? fragments_total : 
+                    std::min<index_type>(fragments_total, resend_end + resend_block);
+                for (index_type pos = resend_first; pos <= resend_end; ++pos)
+                    fragments.reset(pos - 1);
+                acknowledged = resend_first - 1;
+                response_urgent = true;
+            }
+            /* INCOMING: the checksum of the size and data of a checked transfer, combined from the checksums 
+            of its fragments, all but the last one or two (the trailer may be split) are max_fragment_size long */
+            transfer_checksum::value_type stream_checksum() const
+            {
+                auto end = stream_size - trailer_size();
+                transfer_checksum full(max_fragment_size);
+                auto ret = fragment_checksums.at(0);
+                for (index_type pos = 2; pos <= fragments_total && (pos - 1) * max_fragment_size < end; ++pos)
+                {
+                    auto size = std::min(max_fragment_size, end - (pos - 1) * max_fragment_size);
+                    ret = size == max_fragment_size ? full.combine(ret, fragment_checksums.at(pos - 1)) :
+                        transfer_checksum(size).combine(ret, fragment_checksums.at(pos - 1));
+                }
+                return ret;
+            }
+            inline data_type::size_type trailer_size() const
+            {
+                return checked ? transfer_checksum::size : 0;
+            }
+            /* INCOMING: rebuilds the missing fragments of the blocks that lack a single one and drops the 
+            parities of the complete blocks, one rebuild may tell the transfer size which allows another one */
+            void rebuild_from_parity()
+            {
+                bool progress = true;
+                while (progress && !parities.empty())
+                {
+                    progress = false;
+                    for (auto p = parities.begin(); p != parities.end();)
+                    {
+                        index_type missing = 0, missing_count = 0;
+                        for (index_type pos = p->first; pos < p->first + p->count; ++pos)
+                        {
+                            if (!fragments.test(pos - 1))
+                            {
+                                missing = pos;
+                                ++missing_count;
+                            }
+                        }
+                        if (missing_count > 1)
+                        {
+                            ++p;
+                            continue;
+                        }
+                        
+                        if (missing_count == 1)
+                        {
+                            /* the size of the last fragment is not known until the transfer size is, unless 
+                            it is alone in its block */
+                            if (missing == fragments_total && !is_size_known() && p->count != 1)
+                            {
+                                ++p;
+                                continue;
+                            }
+                            auto d = p->data;
+                            for (index_type pos = p->first; pos < p->first + p->count; ++pos)
+                                if (pos != missing)
+                                    xor_received(pos, d);
+                            if (p->count != 1)
+                                d.shrink(0, d.size() - fragment_size(missing));
+                            if (put_fragment_data(missing, d))
+                            {
+                                ++rebuilt;
+                                progress = true;
+                            }
+                        }
+                        p = parities.erase(p);
+                    }
+                }
+            }
+            /* INCOMING: XORs the received fragment at pos into out, as it was on the wire */
+            void xor_received(index_type pos, data_type & out) const
+            {
+                auto apply = [&](auto begin, data_type::size_type size, data_type::size_type offset){
+                    std::transform(begin, begin + std::min(size, out.size() - offset), out.begin() + offset, 
+                        out.begin() + offset, std::bit_xor<byte>());
+                };
+                if (!is_size_known() || streaming)
+                {
+                    auto held = [pos](const auto & ef){return ef.first == pos;};
+                    auto e = std::find_if(early_fragments.begin(), early_fragments.end(), held);
+                    if (e != early_fragments.end())
+                        apply(e->second.begin(), e->second.size(), 0);
+                    else if (auto h = std::find_if(history.begin(), history.end(), held); h != history.end())
+                        apply(h->second.begin(), h->second.size(), 0);
+                    return;
+                }
+                
+                auto start = (pos - 1) * max_fragment_size, offset = start;
+                for_stream(start, start + fragment_size(pos), to_bytes(static_cast<length_type>(data().size())), trailer, 
+                    [&](data_type::const_iterator begin, data_type::size_type size){
+                        apply(begin, size, offset - start);
+                        offset += size;
+                    });
+            }
+            /* calls f(begin, size) with the pieces of the stream between the offsets start and end in order, 
+            the stream is made of length, data() and the trailer of checked transfers */
+            template<typename F>
+            void for_stream(data_type::size_type start, data_type::size_type end, const data_type & length, 
+                const data_type & checksum, F f) const
+            {
+                auto data_end = stream_size - trailer_size();
+                while (start < end)
                 {
-                    if (transfer_state != state::RETRY && current_fragment < fragments_total)
-                        ++current_fragment;
+                    data_type::size_type size;
+                    if (start < length_size)
+                    {
+                        size = std::min(end, length_size) - start;
+                        f(length.begin() + start, size);
+                    }
+                    else if (start < data_end)
+                    {
+                        size = std::min(end, data_end) - start;
+                        f(data().begin() + (start - length_size), size);
+                    }
+                    else
+                    {
+                        size = end - start;
+                        f(checksum.begin() + (start - data_end), size);
+                    }
+                    start += size;
+                }
+            }
 
-                    transfer_state = state::WAITING;
+            /* INCOMING: the transfer size is now known, allocates data() and moves the early fragments into it, 
+            returns false when the size does not match fragments_total */
+            bool set_stream_size(data_type::size_type size)
+            {
+                if (size <= length_size + trailer_size() || 
+                    fragments_needed(size - length_size - trailer_size(), max_fragment_size, trailer_size()) != fragments_total)
+                    return false;
+
+                stream_size = size;
+                /* the streamed transfer holds on to the fragments until they are handed over */
+                if (streaming)
                     return true;
+                data() = data_type(stream_size - length_size - trailer_size());
+                for (const auto & [pos, d] : early_fragments)
+                    store_fragment(pos, d);
+                early_fragments = {};
+                return true;
+            }
+            /* INCOMING: copies the fragment's data into data(), without the size in the first one, the checksum 
+            of a checked transfer goes to trailer, returns true when the checksum of the fragment changed */
+            bool store_fragment(index_type pos, const data_type & d)
+            {
+                auto start = (pos - 1) * max_fragment_size, data_end = stream_size - trailer_size();
+                auto skip = pos == 1 ? length_size : 0;
+                auto size = start < data_end ? std::min(d.size(), data_end - start) : 0;
+                if (size > skip)
+                    std::copy(d.begin() + skip, d.begin() + size, data().begin() + (start + skip - length_size));
+                if (!checked)
+                    return false;
+
+                if (size < d.size())
+                    std::copy(d.begin() + size, d.end(), trailer.begin() + (start + size - data_end));
+                auto checksum = transfer_checksum::compute(d.begin(), d.begin() + size);
+                bool changed = checksum != fragment_checksums.at(pos - 1);
+                fragment_checksums.at(pos - 1) = checksum;
+                return changed;
+            }
+            /* OUTGOING: lays the data out with room for the fragmentation Header and the interface around 
+            every fragment, this is the only copy of the data the handler does, fragments are views into 
+            the wire buffer. a single fragment transfer that already has the room is just moved */
+            void prepare_wire(const prealloc_size & alloc)
+            {
+                if (wire)
+                    return;
+                
+                auto length = to_bytes(static_cast<length_type>(data().size()));
+                wire_front = sizeof(Header) + alloc.front();
+                lent_fragments.resize(fragments_total);
+                if (fragments_total == 1 && data().capacity_front() >= wire_front + length_size && 
+                    data().capacity_back() >= alloc.back() + trailer_size())
+                {
+                    wire = std::make_shared<data_type>(std::move(data()));
+                    wire->push_front(length);
+                    if (checked)
+                        wire->push_back(to_bytes(transfer_checksum::compute(wire->begin(), wire->end())));
+                    wire_stride = 0;
+                    return;
                 }
-                return false;
+
+                /* the checksum is taken along the copy, it is complete by the time the trailer is reached */
+                auto data_end = stream_size - trailer_size();
+                data_type checksum(trailer_size());
+                etl::crc32 crc;
+                data_type::size_type covered = 0;
+                wire_stride = wire_front + max_fragment_size + alloc.back();
+                wire = std::make_shared<data_type>(fragments_total * wire_stride);
+                for (index_type pos = 1; pos <= fragments_total; ++pos)
+                {
+                    auto out = wire_fragment_begin(pos);
+                    auto start = (pos - 1) * max_fragment_size;
+                    for_stream(start, start + fragment_size(pos), length, checksum, 
+                        [&](data_type::const_iterator begin, data_type::size_type size){
+                            if (checked && covered < data_end)
+                            {
+                                crc.add(begin, begin + size);
+                                if ((covered += size) == data_end)
+                                {
+                                    auto value = to_bytes(crc.value());
+                                    std::copy(value.begin(), value.end(), checksum.begin());
+                                }
+                            }
+                            out = std::copy(begin, begin + size, out);
+                        });
+                }
+                data().clear();
+            }
+            inline Header create_header(message_types type, index_type pos, status_type status = 0) const
+            {
+                return Header(type, pos, fragments_total, get_id(), get_prev_id(), status);
+            }
+            fragment create_response(message_types type, index_type pos, const prealloc_size & alloc, status_type status)
+            {
+                auto data = alloc.create(sizeof(Header), 0, 0);
+                data.push_front(to_bytes(create_header(type, pos, status)));
+                last_tx_time = coarse_clock::now();
+                return fragment(create_response_fragment_metadata(), std::move(data));
             }
         };
     }
@@ -0,0 +1,152 @@
+/*
+ * This file is a part of the libprotoserial project
+ * https://github.com/georges-circuits/libprotoserial
+ *
+ * Copyright (C) 2022 Jiří Maňák - All Rights Reserved
+ * For contact information visit https://manakjiri.eu/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/gpl.html>
+ */
+
+#ifndef _SP_FRAGMENTATION_TRANSFERSCHEDULER
+#define _SP_FRAGMENTATION_TRANSFERSCHEDULER
+
+#include "libprotoserial/fragmentation/transfer.hpp"
+
+#include <array>
+#include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <optional>
+#include <utility>
+#include <algorithm>
+
+namespace sp::detail
+{
+    /* weighted fair queue of the outgoing transfers (start-time fair queuing)
+    the transfers are grouped into flows by their peer and priority class, each flow has a virtual start
+    tag that grows by size / weight with every fragment the flow transmits, the flow with the lowest tag
+    goes next, so the flows share the link in proportion to the weights of their classes and a small
+    transfer of a high class does not wait behind a large transfer of a low one
+    the flows are kept ordered by their tags, the selection takes the first flow which has a transfer
+    ready to transmit, that is O(log n) unless the flows in front are held back by their peers
+    transfers are referred to by their slot in the transfer_table */
+    class transfer_scheduler
+    {
+        public:
+        using slot_type = std::size_t;
+        using address_type = fragment_metadata::address_type;
+        using priority_type = transfer_metadata::priority_type;
+        using weights_type = std::array<uint, transfer_metadata::priority_classes>;
+
+        transfer_scheduler(weights_type weights) :
+            _weights(weights) {}
+
+        void add(slot_type slot, address_type peer, priority_type priority)
+        {
+            flow_key key(peer, std::min<priority_type>(priority, transfer_metadata::priority_classes - 1));
+            auto f = _flows.find(key);
+            if (f == _flows.end())
+            {
+                /* a new flow starts at the current virtual time, it did not save up any credit */
+                f = _flows.emplace(key, flow{_virtual_time, {}}).first;
+                _order.emplace(_virtual_time, key);
+            }
+            f->second.slots.push_back(slot);
+            _slots[slot] = key;
+        }
+
+        void remove(slot_type slot)
+        {
+            auto s = _slots.find(slot);
+            if (s == _slots.end())
+                return;
+
+            auto f = _flows.find(s->second);
+            auto & slots = f->second.slots;
+            slots.erase(std::find(slots.begin(), slots.end(), slot));
+            if (slots.empty())
+            {
+                _order.erase({f->second.start, f->first});
+                _flows.erase(f);
+            }
+            _slots.erase(s);
+        }
+
+        /* the slot of the transfer to transmit next, ready(slot) tells whether the transfer can transmit,
+        among the ready transfers of a flow the one with the highest score(slot) wins, the first one on a tie */
+        template<typename Ready, typename Score>
+        std::optional<slot_type> select(Ready ready, Score score) const
+        {
+            for (const auto & [start, key] : _order)
+            {
+                std::optional<slot_type> best;
+                int best_score = 0;
+                for (auto slot : _flows.at(key).slots)
+                {
+                    if (!ready(slot))
+                        continue;
+                    auto sc = score(slot);
+                    if (!best || sc > best_score)
+                    {
+                        best = slot;
+                        best_score = sc;
+                    }
+                }
+                if (best)
+                    return best;
+            }
+            return std::nullopt;
+        }
+
+        /* the transfer in slot transmitted size bytes, its flow moves back in the queue */
+        void charge(slot_type slot, bytes::size_type size)
+        {
+            auto s = _slots.find(slot);
+            if (s == _slots.end())
+                return;
+
+            auto & f = _flows.at(s->second);
+            _order.erase({f.start, s->second});
+            /* a flow which was held back does not get to catch up at the expense of the others */
+            auto start = std::max(f.start, _virtual_time);
+            _virtual_time = start;
+            f.start = start + static_cast<double>(size) / std::max<uint>(_weights[s->second.second], 1);
+            _order.emplace(f.start, s->second);
+        }
+
+        bool empty() const {return _slots.empty();}
+
+        private:
+        using flow_key = std::pair<address_type, priority_type>;
+
+        struct flow
+        {
+            double start;
+            /* the transfers in the order they were added */
+            std::deque<slot_type> slots;
+        };
+
+        weights_type _weights;
+        std::map<flow_key, flow> _flows;
+        /* the flows ordered by their start tags */
+        std::set<std::pair<double, flow_key>> _order;
+        std::unordered_map<slot_type, flow_key> _slots;
+        /* the start tag of the last served flow */
+        double _virtual_time = 0;
+    };
+}
+
+#endif
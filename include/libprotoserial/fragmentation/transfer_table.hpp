@@ -0,0 +1,240 @@
+/*
+ * This file is a part of the libprotoserial project
+ * https://github.com/georges-circuits/libprotoserial
+ *
+ * Copyright (C) 2022 Jiří Maňák - All Rights Reserved
+ * For contact information visit https://manakjiri.eu/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/gpl.html>
+ */
+
+#ifndef _SP_FRAGMENTATION_TRANSFERTABLE
+#define _SP_FRAGMENTATION_TRANSFERTABLE
+
+#include "libprotoserial/interface/fragment.hpp"
+
+#include <vector>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <cstdint>
+#include <iterator>
+#include <algorithm>
+
+namespace sp
+{
+    /* identifies a transfer within a fragmentation handler, the peer is the source of incoming
+    transfers and the destination of outgoing ones */
+    struct transfer_key
+    {
+        interface_identifier iid;
+        fragment_metadata::address_type peer;
+        uint id;
+        bool incoming;
+
+        constexpr bool operator==(const transfer_key & other) const
+        {
+            return iid == other.iid && peer == other.peer && id == other.id && incoming == other.incoming;
+        }
+
+        struct hash
+        {
+            std::size_t operator()(const transfer_key & k) const noexcept
+            {
+                std::uint64_t v = static_cast<std::uint64_t>(k.iid.instance) |
+                    static_cast<std::uint64_t>(k.iid.identifier) << 8 |
+                    static_cast<std::uint64_t>(k.id & 0xffff) << 16 |
+                    static_cast<std::uint64_t>(k.peer & 0x7fffffff) << 32 |
+                    static_cast<std::uint64_t>(k.incoming) << 63;
+                return std::hash<std::uint64_t>()(v);
+            }
+        };
+    };
+
+    namespace detail
+    {
+        /* storage of the transfer handlers of a fragmentation handler
+        the handlers live in a pool of slots that get reused, so there is no allocation per transfer once
+        the pool has grown, they are indexed by their transfer_key, by their peer and by the object IDs of 
+        the fragments they have transmitted (see Handler::get_indexed_fragment_ids()), so that responses, 
+        the ACKs going along with other fragments and the transmit_began_event do not need to scan all the transfers
+        iteration goes over the slots in order, iterators stay valid across emplace() */
+        template<class Handler>
+        class transfer_table
+        {
+            struct slot
+            {
+                std::optional<Handler> handler;
+                transfer_key key;
+                /* the fragment IDs of this handler present in the _fragments index */
+                std::vector<object_id_type> indexed;
+            };
+
+            public:
+            using value_type = Handler;
+            using size_type = std::size_t;
+
+            class iterator
+            {
+                public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = Handler;
+                using difference_type = std::ptrdiff_t;
+                using pointer = Handler*;
+                using reference = Handler&;
+
+                iterator() = default;
+                iterator(transfer_table * t, size_type i) : _table(t), _index(i) {skip();}
+
+                reference operator*() const {return *_table->_slots[_index].handler;}
+                pointer operator->() const {return &*_table->_slots[_index].handler;}
+                iterator & operator++() {++_index; skip(); return *this;}
+                iterator operator++(int) {auto ret = *this; ++(*this); return ret;}
+                bool operator==(const iterator & other) const {return _index == other._index;}
+                bool operator!=(const iterator & other) const {return _index != other._index;}
+
+                size_type index() const {return _index;}
+
+                private:
+                void skip()
+                {
+                    while (_index < _table->_slots.size() && !_table->_slots[_index].handler)
+                        ++_index;
+                }
+
+                transfer_table * _table = nullptr;
+                size_type _index = 0;
+            };
+
+            iterator begin() {return iterator(this, 0);}
+            iterator end() {return iterator(this, _slots.size());}
+
+            size_type size() const {return _keys.size();}
+            bool empty() const {return size() == 0;}
+
+            template<typename... Args>
+            iterator emplace(Args&&... args)
+            {
+                size_type i;
+                if (!_free.empty())
+                {
+                    i = _free.back();
+                    _free.pop_back();
+                }
+                else
+                {
+                    i = _slots.size();
+                    _slots.emplace_back();
+                }
+
+                auto & s = _slots[i];
+                auto & h = s.handler.emplace(std::forward<Args>(args)...);
+                s.key = key_of(h);
+                /* a newer transfer with the same key shadows the older one */
+                _keys[s.key] = i;
+                _peers[peer_of(s.key)].push_back(i);
+                return iterator(this, i);
+            }
+
+            iterator erase(iterator itr)
+            {
+                auto i = itr.index();
+                auto & s = _slots[i];
+                auto k = _keys.find(s.key);
+                if (k != _keys.end() && k->second == i)
+                    _keys.erase(k);
+                /* the emptied lists stay, there are only as many as there are peers */
+                auto & peer = _peers[peer_of(s.key)];
+                peer.erase(std::find(peer.begin(), peer.end(), i));
+                for (auto id : s.indexed)
+                    _fragments.erase(id);
+                s.indexed.clear();
+                s.handler.reset();
+                _free.push_back(i);
+                return ++itr;
+            }
+
+            iterator find(const transfer_key & key)
+            {
+                auto k = _keys.find(key);
+                return k == _keys.end() ? end() : iterator(this, k->second);
+            }
+
+            /* calls f with the iterator of every transfer with the peer in the direction, 
+            f must not emplace() nor erase() */
+            template<typename F>
+            void for_each_with_peer(interface_identifier iid, fragment_metadata::address_type peer, bool incoming, F && f)
+            {
+                auto p = _peers.find(transfer_key{iid, peer, 0, incoming});
+                if (p != _peers.end())
+                    for (auto i : p->second)
+                        f(iterator(this, i));
+            }
+
+            /* the transfer in the slot at index, see iterator::index() */
+            iterator at(size_type index)
+            {
+                return iterator(this, index);
+            }
+
+            /* finds the transfer which transmitted the fragment of this object ID */
+            iterator find_transmitted(object_id_type id)
+            {
+                auto f = _fragments.find(id);
+                return f == _fragments.end() ? end() : iterator(this, f->second);
+            }
+
+            /* call after the handler transmitted a fragment, the fragment IDs the handler still cares
+            about replace the ones indexed previously */
+            void update_fragment_index(iterator itr)
+            {
+                auto i = itr.index();
+                auto & s = _slots[i];
+                for (auto id : s.indexed)
+                    _fragments.erase(id);
+                s.indexed.clear();
+                for (auto id : s.handler->get_indexed_fragment_ids())
+                {
+                    if (id != 0)
+                    {
+                        _fragments[id] = i;
+                        s.indexed.push_back(id);
+                    }
+                }
+            }
+
+            static transfer_key key_of(const Handler & h)
+            {
+                return transfer_key{h.interface_id(), h.is_incoming() ? h.source() : h.destination(),
+                    h.get_id(), h.is_incoming()};
+            }
+
+            private:
+            /* the key of all the transfers with the same peer in the same direction */
+            static transfer_key peer_of(const transfer_key & k)
+            {
+                return transfer_key{k.iid, k.peer, 0, k.incoming};
+            }
+
+            /* a deque so that growing it never moves the handlers, a copy would give them new object IDs */
+            std::deque<slot> _slots;
+            std::vector<size_type> _free;
+            std::unordered_map<transfer_key, size_type, transfer_key::hash> _keys;
+            std::unordered_map<transfer_key, std::vector<size_type>, transfer_key::hash> _peers;
+            std::unordered_map<object_id_type, size_type> _fragments;
+        };
+    }
+}
+
+#endif
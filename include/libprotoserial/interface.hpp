@@ -45,6 +45,7 @@
 
 #ifdef SP_LINUX
 #include "libprotoserial/interface/linux/uart.hpp"
+#include "libprotoserial/interface/linux/stream.hpp"
 #endif
 
 namespace sp
@@ -61,6 +62,19 @@ namespace sp
         using detail::virtual_interface<sp::headers::interface_8b8b, sp::footers::crc32>::virtual_interface;
     };
 
+    /* the wide_ variants use 16 bit addresses and data size, use them where the link supports large frames */
+    class wide_loopback_interface : 
+        public detail::loopback_interface<sp::headers::interface_16b16b, sp::footers::crc32> 
+    {
+        using detail::loopback_interface<sp::headers::interface_16b16b, sp::footers::crc32>::loopback_interface;
+    };
+
+    class wide_virtual_interface : 
+        public detail::virtual_interface<sp::headers::interface_16b16b, sp::footers::crc32> 
+    {
+        using detail::virtual_interface<sp::headers::interface_16b16b, sp::footers::crc32>::virtual_interface;
+    };
+
 
 #if defined(SP_STM32ZST)
     namespace env = detail::stm32_zst;
@@ -77,6 +91,11 @@ namespace sp
     {
     	using env::uart_interface<sp::headers::interface_8b8b, sp::footers::crc32>::uart_interface;
     };
+    class wide_uart_interface:
+    	public env::uart_interface<sp::headers::interface_16b16b, sp::footers::crc32>
+    {
+    	using env::uart_interface<sp::headers::interface_16b16b, sp::footers::crc32>::uart_interface;
+    };
 #if defined(ZST_UART_ENABLED)
 #define SP_RS485_AVAILABLE
     class rs485_interface:
@@ -87,6 +106,23 @@ namespace sp
 #endif
 #endif
 
+#if defined(SP_LINUX)
+#define SP_STREAM_AVAILABLE
+    /* preamble-free, length-delimited interfaces for reliable byte streams, these are the host side
+    counterparts of the usbcdc_stream_interface, use detail::pc::stream_interface with footers::none 
+    to drop the crc as well when the transport is trusted */
+    class stream_interface:
+        public env::stream_interface<sp::headers::interface_8b8b, sp::footers::crc32>
+    {
+        using env::stream_interface<sp::headers::interface_8b8b, sp::footers::crc32>::stream_interface;
+    };
+    class wide_stream_interface:
+        public env::stream_interface<sp::headers::interface_16b16b, sp::footers::crc32>
+    {
+        using env::stream_interface<sp::headers::interface_16b16b, sp::footers::crc32>::stream_interface;
+    };
+#endif
+
 #if defined(SP_STM32ZST) && defined(ZST_USBCDC_ENABLED)
 #define SP_USBCDC_AVAILABLE
     class usbcdc_interface:
@@ -94,6 +130,21 @@ namespace sp
     {
         using env::usbcdc_interface<sp::headers::interface_8b8b, sp::footers::crc32>::usbcdc_interface;
     };
+    class wide_usbcdc_interface:
+        public env::usbcdc_interface<sp::headers::interface_16b16b, sp::footers::crc32>
+    {
+        using env::usbcdc_interface<sp::headers::interface_16b16b, sp::footers::crc32>::usbcdc_interface;
+    };
+    class usbcdc_stream_interface:
+        public env::usbcdc_stream_interface<sp::headers::interface_8b8b, sp::footers::crc32>
+    {
+        using env::usbcdc_stream_interface<sp::headers::interface_8b8b, sp::footers::crc32>::usbcdc_stream_interface;
+    };
+    class wide_usbcdc_stream_interface:
+        public env::usbcdc_stream_interface<sp::headers::interface_16b16b, sp::footers::crc32>
+    {
+        using env::usbcdc_stream_interface<sp::headers::interface_16b16b, sp::footers::crc32>::usbcdc_stream_interface;
+    };
 #endif
 
 }
@@ -61,6 +61,8 @@ namespace sp
             	_write_it = _rx_buffer.begin();
             }
 
+            bytes::size_type receive_buffer_size() const noexcept {return _rx_buffer.size();}
+
 
             /* iterator pointing into the _rx_buffer, it supports wrapping */
             struct circular_iterator 
@@ -174,6 +176,16 @@ namespace sp
                 return _rx_buffer.size();
             }
 
+            /* true if the fragment described by the Header should be parsed, it is only worth the effort 
+            when the fragment is addressed to us or when someone is subscribed to other_receive_event */
+            template<class Header>
+            bool is_accepted(const Header & h) const noexcept
+            {
+                return interface::address_type(h.destination) == get_address() || 
+                    interface::address_type(h.destination) == get_broadcast_address() ||
+                    other_receive_event.has_subscribers();
+            }
+
             bytes _rx_buffer;
             volatile bytes::iterator _write_it;
             volatile uint _byte_count;
@@ -203,7 +215,13 @@ namespace sp
                 _last_byte_count = _byte_count;
             }
 
-            bytes::size_type max_data_size() const noexcept {return _max_fragment_size - (sizeof(Header) + sizeof(Footer) + preamble_length);}
+            /* the data size is limited by the max_fragment_size given in the constructor as well as by 
+            the size field of the Header, wider Headers allow for larger frames */
+            bytes::size_type max_data_size() const noexcept 
+            {
+                return std::min<bytes::size_type>(_max_fragment_size - (sizeof(Header) + sizeof(Footer) + preamble_length), 
+                    std::numeric_limits<typename Header::size_type>::max());
+            }
             prealloc_size minimum_prealloc() const noexcept {return prealloc_size(sizeof(Header) + preamble_length, sizeof(Footer));}
             
             protected:
@@ -233,6 +251,13 @@ namespace sp
 #ifdef SP_BUFFERED_CRITICAL
                     std::cout << "do_receive: buffer overflow" << '\n';
 #endif               
+                    log_receive_buffer_level(rx_buffer_size());
+                }
+                else
+                {
+                    /* the unparsed bytes that were left over from the last call plus the newly 
+                    loaded ones, this is the receive buffer occupancy the flow control cares about */
+                    log_receive_buffer_level(distance(read, write));
                 }
 
                 /* while is necessary since we would never move forward in case we find a valid preamble but fail 
@@ -264,6 +289,17 @@ namespace sp
                                 /* once again, check that there are enough bytes in the buffer, this can still fail */
                                 if ((size_t)distance(fragment_start, write) + 1 >= fragment_size)
                                 {
+                                    /* on a shared bus most fragments are addressed to someone else, skip those
+                                    without copying and checksumming them unless there is someone listening, only the 
+                                    preamble is skipped since a Header in the line noise could jump over a real fragment */
+                                    if (!is_accepted(h))
+                                    {
+                                        _read = read = fragment_start;
+#ifdef SP_BUFFERED_DEBUG
+                                        std::cout << "do_receive skipped fragment for " << (int)h.destination << std::endl;
+#endif
+                                        continue;
+                                    }
                                     /* we have received the entire fragment, prepare it for parsing */
                                     //bytes b = parsers::byte_copy(fragment_start, fragment_start + fragment_size); //FIXME should be a function
                                     auto fragment_end = fragment_start + fragment_size, it = fragment_start;
@@ -328,6 +364,8 @@ namespace sp
                         }
                     }
                 }
+                /* the whole buffer was scanned without finding a preamble, there is no need to scan it again */
+                _read = read;
                 END:
 #ifdef SP_BUFFERED_DEBUG
                 std::cout << "do_receive returning at: " << _read._current - _read._begin << " of " << this->_write_it - _read._begin << std::endl;
@@ -27,6 +27,8 @@
 #include "etl/crc32.h"
 #include "etl/crc16.h"
 
+#include <type_traits>
+
 namespace sp
 {
     namespace footers
@@ -60,6 +62,20 @@ namespace sp
             crc16(const bytes & b) :
                 crc16(b.cbegin(), b.cend()) {}
         };
+
+        /* no Footer at all, for reliable byte streams (USB CDC, pipes, sockets) that already 
+        guarantee ordering and integrity, the hash is never compared */
+        struct none
+        {
+            none() = default;
+            none(bytes::const_iterator, bytes::const_iterator) {}
+            none(const bytes &) {}
+        };
+
+        /* number of bytes the Footer occupies in the serialized fragment, an empty 
+        struct still has a sizeof of 1, so footers::none needs special treatment */
+        template<class Footer>
+        inline constexpr bytes::size_type size_of = std::is_empty_v<Footer> ? 0 : sizeof(Footer);
     }
 }
 
@@ -64,7 +64,7 @@ namespace sp
 
         fragment_metadata create_response_fragment_metadata() const
         {
-            return fragment_metadata(destination(), source(), interface_id(), time_point::clock::now());
+            return fragment_metadata(destination(), source(), interface_id(), coarse_clock::now());
         }
 
         //TODO match_as_response fragment formalize
@@ -98,7 +98,7 @@ namespace sp
         fragment() = default;
 
         fragment(address_type src, address_type dst, data_type && d, interface_identifier iid, 
-            time_point t = clock::now()) :
+            time_point t = coarse_clock::now()) :
                 fragment_metadata(src, dst, iid, t), _data(std::move(d)) {}
 
         fragment(fragment_metadata && metadata, data_type && d):
@@ -50,6 +50,41 @@ namespace sp
                 return check == (byte)(destination + source + size) && size > 0 && size <= max_size && destination != source;
             }
         };
+
+        /* wide variant for links that can carry large frames (USB CDC, fast UARTs), addresses 
+        and data size are 16 bits, so a single frame can carry up to 65535 bytes of data.
+        the check is 16 bits wide as well, with the larger size range an 8 bit check would let 
+        the parser lock onto misaligned headers too often */
+        struct __attribute__ ((__packed__)) interface_16b16b
+        {
+            typedef std::uint16_t       address_type;
+            typedef std::uint16_t       size_type;
+            typedef std::uint16_t       check_type;
+
+            address_type destination = 0;
+            address_type source = 0;
+            size_type size = 0;
+            check_type check = 0;
+
+            interface_16b16b() = default;
+            interface_16b16b(const fragment & p):
+                destination(p.destination()), source(p.source()), size(p.data().size())
+            {
+                check = compute_check();
+            }
+
+            bool is_valid(size_type max_size) const 
+            {
+                return check == compute_check() && size > 0 && size <= max_size && destination != source;
+            }
+
+            private:
+            /* the check does not depend on the order of destination and source */
+            check_type compute_check() const
+            {
+                return (check_type)(destination + source + size);
+            }
+        };
     }
 }
 
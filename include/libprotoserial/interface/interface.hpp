@@ -52,14 +52,26 @@ namespace sp
 
         using address_type = fragment::address_type;
 
+        /* snapshot of the interface load, this is what the upper layers use for flow control */
+        struct status
+        {
+            /* number of received bytes that were waiting in the receive buffer at the beginning 
+            of the last do_receive, this is the peak occupancy observed by the main_task */
+            bytes::size_type receive_buffer_level = 0;
+            /* total size of the receive buffer in bytes, 0 if the interface is not buffered */
+            bytes::size_type receive_buffer_size = 0;
+            /* number of serialized fragments waiting in the transmit queue */
+            uint transmit_queue_level = 0;
+        };
+
         /* - name should uniquely identify the interface on this device
          * - address is the interface address, when a fragment is received where destination() == address
          *   then the receive_event is emitted, otherwise the other_receive_event is emitted
          * - max_queue_size sets the maximum number of fragments the transmit queue can hold
          */
         interface(interface_identifier iid, address_type address, address_type broadcast_address, uint max_queue_size) : 
-            _bytes_txed(0), _bytes_rxed(0), _max_queue_size(max_queue_size), _interface_id(iid), _address(address), 
-            _broadcast_address(broadcast_address) {}
+            _bytes_txed(0), _bytes_rxed(0), _rx_level(0), _max_queue_size(max_queue_size), _interface_id(iid), 
+            _address(address), _broadcast_address(broadcast_address) {}
 
         virtual ~interface() {}
         
@@ -69,6 +81,7 @@ namespace sp
             /* here we have complete information about the interface - we can count the outgoing and incoming
             bytes, track the frequency and various other factors. we could probably also figure out how often and 
             how reliably this main_task function is called and gauge the system load */
+            coarse_clock::update();
             
             do_receive();
 
@@ -103,6 +116,16 @@ namespace sp
             }
         }
 
+        /* returns the current load of the interface, see the status struct */
+        status get_status() const noexcept
+        {
+            status s;
+            s.receive_buffer_level = _rx_level;
+            s.receive_buffer_size = receive_buffer_size();
+            s.transmit_queue_level = _tx_queue.size();
+            return s;
+        }
+
         bool is_writable() const {return _tx_queue.size() <= _max_queue_size;}
         uint writable_count() const {return _max_queue_size - _tx_queue.size();}
         
@@ -120,6 +143,9 @@ namespace sp
         /* returns the prealloc size that, is used for the provided fragments to be transmitted, will
         enable copy-free push_back, push_front of the interface's footer and header */
         virtual prealloc_size minimum_prealloc() const noexcept = 0;
+        /* returns the size of the receive buffer in bytes, interfaces that do not buffer the raw
+        received data can leave this at 0, receive_buffer_level is then never reported */
+        virtual bytes::size_type receive_buffer_size() const noexcept {return 0;}
 
         /* emitted by the main_task function when a new fragment is received where the destination address matches
         the interface address */
@@ -168,10 +194,18 @@ namespace sp
             _bytes_rxed += size;
         }
 
+        /* call this function from do_receive with the number of bytes that are waiting 
+        in the receive buffer, it is reported through get_status() */
+        void log_receive_buffer_level(bytes::size_type level)
+        {
+            _rx_level = level;
+        }
+
         private:
 
         std::queue<serialized> _tx_queue;
         uint64_t _bytes_txed, _bytes_rxed;
+        bytes::size_type _rx_level;
         uint _max_queue_size;
         interface_identifier _interface_id;
         address_type _address, _broadcast_address;
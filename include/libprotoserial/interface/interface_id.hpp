@@ -40,6 +40,7 @@ namespace sp
             LOOPBACK,
             UART,
             USBCDC,
+            STREAM,
         };
 
         using enum identifier_type;
@@ -0,0 +1,163 @@
+/*
+ * This file is a part of the libprotoserial project
+ * https://github.com/georges-circuits/libprotoserial
+ * 
+ * Copyright (C) 2022 Jiří Maňák - All Rights Reserved
+ * For contact information visit https://manakjiri.eu/
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/gpl.html>
+ */
+
+
+#ifndef _SP_INTERFACE_LINUX_STREAM
+#define _SP_INTERFACE_LINUX_STREAM
+
+#include "libprotoserial/interface/stream.hpp"
+
+#include <string>
+#include <algorithm>
+
+// Linux headers
+#include <string.h>
+#include <fcntl.h> // Contains file controls like O_RDWR
+#include <errno.h> // Error integer and strerror() function
+#include <unistd.h> // write(), read(), close()
+
+#ifdef SP_ENABLE_EXCEPTIONS
+#include <stdexcept>
+#endif
+
+namespace sp
+{
+namespace detail
+{
+namespace pc
+{
+/* host counterpart of the preamble-free stream interfaces, works on top of any file 
+descriptor that behaves like a reliable byte stream - a USB CDC tty, pipe, socket or pty */
+template<class Header, class Footer>
+class stream_interface : public stream_parser_interface<Header, Footer>
+{
+    using parent = stream_parser_interface<Header, Footer>;
+    
+    public: 
+
+#ifdef SP_ENABLE_EXCEPTIONS
+    struct open_failed : std::exception {
+        open_failed(std::string m = ""): _m(std::move(m)) {}
+        const char* what () const throw () {return _m.c_str();}
+        std::string _m;
+    };
+#endif
+
+    /* fd is an already opened file descriptor, it is switched to non-blocking mode but
+    it is not closed by the interface, the caller owns it */
+    stream_interface(int fd, interface_identifier::instance_type instance, interface::address_type address, 
+        interface::address_type broadcast_address, uint max_queue_size, uint max_fragment_size, uint buffer_size):
+            parent(interface_identifier(interface_identifier::identifier_type::STREAM, instance), address, broadcast_address,
+            max_queue_size, buffer_size, max_fragment_size), _fd(fd), _owns_fd(false)
+    {
+        if (_fd >= 0)
+            fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    /* opens the device or fifo at path, the file descriptor is closed with the interface */
+    stream_interface(const std::string & path, interface_identifier::instance_type instance, interface::address_type address, 
+        interface::address_type broadcast_address, uint max_queue_size, uint max_fragment_size, uint buffer_size):
+            stream_interface(open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK), instance, address, broadcast_address, 
+            max_queue_size, max_fragment_size, buffer_size)
+    {
+        _owns_fd = true;
+#ifdef SP_ENABLE_EXCEPTIONS
+        if (_fd < 0)
+            throw open_failed("Error " + std::to_string(errno) + " opening " + path + ": " + strerror(errno));
+#endif
+    }
+
+    stream_interface(const stream_interface &) = delete;
+    stream_interface & operator=(const stream_interface &) = delete;
+
+    ~stream_interface() 
+    {
+        if (_owns_fd && _fd >= 0)
+            close(_fd);
+    }
+
+    protected:
+
+    /* the next fragment waits until the descriptor took all of the previous one */
+    bool can_transmit() noexcept 
+    {
+        return _fd >= 0 && flush() && _unsent.is_empty();
+    }
+    bool do_transmit(bytes && buff) noexcept 
+    {
+        _unsent = std::move(buff);
+        return flush();
+    }
+    bytes::size_type do_receive() noexcept
+    {
+        /* the rest of the last fragment goes out even when nothing else is queued */
+        flush();
+        return parent::do_receive();
+    }
+    /* writes as much of the unsent data as the descriptor takes without blocking, the rest waits 
+    for the next call, returns false and drops the data when the write fails */
+    bool flush() noexcept
+    {
+        while (!_unsent.is_empty())
+        {
+            auto ret = write(_fd, _unsent.data(), _unsent.size());
+            if (ret > 0)
+                _unsent.shrink(static_cast<bytes::size_type>(ret), 0);
+            else if (ret < 0 && errno == EINTR)
+                continue;
+            else if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                _unsent.clear();
+                return false;
+            }
+            else
+                break;
+        }
+        return true;
+    }
+    /* reads no more than fits into the receive buffer, the rest waits in the descriptor 
+    so that a fast sender is held back by the kernel instead of overflowing the buffer */
+    void do_single_receive() 
+    {
+        byte read_buf[64];
+        ssize_t num_bytes = 0;
+        bytes::size_type room = 0;
+        do {
+            room = std::min<bytes::size_type>(this->receive_room(), sizeof(read_buf));
+            if (room == 0)
+                break;
+            num_bytes = read(_fd, read_buf, room);
+            for (ssize_t i = 0; i < num_bytes; i++)
+                this->put_single_received(read_buf[i]);
+        } while (num_bytes > 0 && static_cast<bytes::size_type>(num_bytes) == room);
+    }
+
+    private:
+    int _fd;
+    bool _owns_fd;
+    /* the part of the last fragment the descriptor did not take yet */
+    bytes _unsent;
+};
+}
+}
+} // namespace sp
+
+#endif
@@ -23,6 +23,7 @@
 #define _SP_INTERFACE_PARSERS
 
 #include "libprotoserial/interface/interface.hpp"
+#include "libprotoserial/interface/footers.hpp"
 
 #include <optional>
 
@@ -40,14 +41,18 @@ namespace sp
             if (!h.is_valid(i.max_data_size()))
                 return std::nullopt;
             
-            /* copy the footer, shrink the container by the footer size and compute the checksum */
-            footer f_parsed;
-            std::copy(buff.end() - sizeof(footer), buff.end(), reinterpret_cast<byte*>(&f_parsed));
-            buff.shrink(0, sizeof(footer));
-            footer f_computed(buff);
-            
-            if (f_parsed.hash != f_computed.hash)
-                return std::nullopt;
+            /* copy the footer, shrink the container by the footer size and compute the checksum,
+            footers::none carries no checksum so there is nothing to compare */
+            if constexpr (footers::size_of<footer> != 0)
+            {
+                footer f_parsed;
+                std::copy(buff.end() - sizeof(footer), buff.end(), reinterpret_cast<byte*>(&f_parsed));
+                buff.shrink(0, sizeof(footer));
+                footer f_computed(buff);
+                
+                if (f_parsed.hash != f_computed.hash)
+                    return std::nullopt;
+            }
             
             /* shrink the container by the header and return the fragment object */
             buff.shrink(sizeof(h), 0);
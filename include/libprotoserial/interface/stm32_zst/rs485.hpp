@@ -55,7 +55,7 @@ namespace stm32_zst
          */
         rs485_interface(zst::uart & uart, zst::gpio de_pin, zst::gpio nre_pin, interface_identifier::instance_type instance, interface::address_type address,
             interface::address_type broadcast_address, uint max_queue_size, uint max_fragment_size, uint buffer_size) :
-                parent(uart, instance, address, broadcast_address, max_queue_size, buffer_size, max_fragment_size), _de_pin(de_pin), _nre_pin(nre_pin)
+                parent(uart, instance, address, broadcast_address, max_queue_size, max_fragment_size, buffer_size), _de_pin(de_pin), _nre_pin(nre_pin)
         {
             /* drive Receiver Output low to enable data receive */
             _nre_pin.reset();
@@ -24,6 +24,7 @@
 
 #include "libprotoserial/interface/interface.hpp"
 #include "libprotoserial/interface/parsers.hpp"
+#include "libprotoserial/interface/stream.hpp"
 
 #include "zst/usb.hpp"
 
@@ -131,6 +132,53 @@ namespace stm32_zst
 		}
 
     };
+
+    /* USB CDC already guarantees ordering and integrity of the data, so this variant drops the preamble 
+    and uses the stream_parser_interface, fragments can span multiple USB packets, the host side 
+    counterpart is the pc::stream_interface while the usbcdc_interface talks to the uart_interface */
+    template<class Header, class Footer>
+    class usbcdc_stream_interface : public stream_parser_interface<Header, Footer>
+    {
+        using parent = stream_parser_interface<Header, Footer>;
+        
+        zst::usb_cdc & _usb;
+
+        public:
+
+        /* PACKET STRUCTURE: [Header][data >= 1][Footer] */
+
+        /* - id should uniquely identify the USBCDC interface on this device
+         * - address is the interface address, when a fragment is received where destination() == address
+         *   then the receive_event is emitted, otherwise the other_receive_event is emitted
+         * - max_queue_size sets the maximum number of fragments the transmit queue can hold
+         * - buffer_size sets the size of the receive buffer in bytes, it should hold at least 
+         *   two max_fragment_size fragments
+         */
+        usbcdc_stream_interface(zst::usb_cdc & usb, interface_identifier::instance_type instance, interface::address_type address,
+            interface::address_type broadcast_address, uint max_queue_size, uint max_fragment_size, uint buffer_size) :
+                parent(interface_identifier(interface_identifier::identifier_type::USBCDC, instance), address, broadcast_address,
+                max_queue_size, buffer_size, max_fragment_size), _usb(usb)
+        {
+            _usb.receive_done.register_callback(&usbcdc_stream_interface::isr_rx_done, this);
+        }
+
+        bool can_transmit() noexcept
+		{
+			return true; //TODO
+		}
+
+		bool do_transmit(bytes && buff) noexcept
+		{
+			return _usb.transmit(static_cast<uint8_t*>(buff.data()), buff.size()).is_ok();
+		}
+
+		void isr_rx_done(uint8_t* data, uint32_t len)
+		{
+			for (uint32_t i = 0; i < len; ++i)
+				this->put_single_received(static_cast<byte>(data[i]));
+		}
+
+    };
 }
 }
 } // namespace sp
@@ -0,0 +1,215 @@
+/*
+ * This file is a part of the libprotoserial project
+ * https://github.com/georges-circuits/libprotoserial
+ * 
+ * Copyright (C) 2022 Jiří Maňák - All Rights Reserved
+ * For contact information visit https://manakjiri.eu/
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/gpl.html>
+ */
+
+
+#ifndef _SP_INTERFACE_STREAM
+#define _SP_INTERFACE_STREAM
+
+#include "libprotoserial/interface/buffered.hpp"
+
+
+#ifdef SP_ENABLE_IOSTREAM
+//#define SP_STREAM_DEBUG
+//#define SP_STREAM_WARNING
+#endif
+
+#ifdef SP_STREAM_DEBUG
+#define SP_STREAM_WARNING
+#endif
+
+namespace sp
+{
+    namespace detail
+    {
+        /* parser for reliable byte streams (USB CDC, pipes, sockets, pty) which already guarantee 
+        ordering and integrity, so there is no need for the preamble and the resynchronization scan 
+        that buffered_parser_interface does. fragments are simply length-delimited by the Header, 
+        the Footer can be footers::none when the transport is trusted to carry the data intact
+        after a receive buffer overflow the fragment boundary is lost, nothing is delivered until the 
+        alignment has been checked, by the Footer of a fragment or, with footers::none, by the Header
+        of the next fragment following right after it, so the last fragment before a pause in the stream
+        waits for the next one in that case
+
+        PACKET STRUCTURE: [Header][data >= 1][Footer] */
+        template<class Header, class Footer>
+        class stream_parser_interface : public buffered_interface
+        {
+            using parent = stream_parser_interface<Header, Footer>;
+
+            public:
+
+            static constexpr bytes::size_type footer_size = footers::size_of<Footer>;
+
+            stream_parser_interface(interface_identifier iid, address_type address, address_type broadcast_address, 
+                uint max_queue_size, uint buffer_size, uint max_fragment_size):
+                    buffered_interface(iid, address, broadcast_address, max_queue_size, buffer_size), _max_fragment_size(max_fragment_size)
+            {
+                _read = rx_buffer_begin();
+                _last_byte_count = _byte_count;
+            }
+
+            bytes::size_type max_data_size() const noexcept 
+            {
+                return std::min<bytes::size_type>(_max_fragment_size - (sizeof(Header) + footer_size), 
+                    std::numeric_limits<typename Header::size_type>::max());
+            }
+            prealloc_size minimum_prealloc() const noexcept {return prealloc_size(sizeof(Header), footer_size);}
+
+            protected:
+
+            virtual void do_single_receive() {}
+
+            /* the number of bytes that can be put into the receive buffer without overwriting the ones 
+            that were not parsed yet, the sources which can hold the data back (a file descriptor) should 
+            not put in more, the buffer_size must exceed the max_fragment_size for that to work */
+            bytes::size_type receive_room() 
+            {
+                return rx_buffer_size() - 1 - distance(_read, rx_buffer_latest());
+            }
+
+            bytes::size_type do_receive() noexcept
+            {
+                do_single_receive();
+                /* _read points to the last consumed byte, just like write points to the last written one,
+                so distance(_read, write) is the number of bytes waiting to be parsed */
+                auto write = rx_buffer_latest();
+
+                uint loaded = _last_byte_count <= _byte_count ? (_byte_count - _last_byte_count) : 
+                    (std::numeric_limits<uint>::max() - _last_byte_count + _byte_count);
+                _last_byte_count = _byte_count;
+                log_received_count(loaded);
+                
+                if (loaded >= rx_buffer_size())
+                {
+                    /* the stream got ahead of us and we have lost the fragment boundary, everything
+                    that follows is parsed as if it was a Header until the stream realigns */
+                    _read = write;
+                    _resync = true;
+#ifdef SP_STREAM_WARNING
+                    std::cout << "do_receive: buffer overflow" << '\n';
+#endif
+                    log_receive_buffer_level(rx_buffer_size());
+                    return 0;
+                }
+
+                /* the unparsed bytes that were left over from the last call plus the newly 
+                loaded ones, this is the receive buffer occupancy the flow control cares about */
+                log_receive_buffer_level(distance(_read, write));
+                
+                /* unlike the buffered_parser_interface we can parse all fragments that are available 
+                in one go since there is no scanning involved */
+                while ((size_t)distance(_read, write) >= sizeof(Header))
+                {
+                    auto fragment_start = _read + 1;
+                    Header h = parsers::byte_copy<Header>(fragment_start);
+                    if (!h.is_valid(max_data_size()))
+                    {
+                        /* we are not aligned with the fragment boundary, this can only happen at startup 
+                        or after an overflow, drop a byte and try again */
+                        _read = fragment_start;
+#ifdef SP_STREAM_WARNING
+                        std::cout << "do_receive invalid Header" << std::endl;
+#endif
+                        continue;
+                    }
+
+                    size_t fragment_size = h.size + sizeof(Header) + footer_size;
+                    /* wait for the rest of the fragment */
+                    if ((size_t)distance(_read, write) < fragment_size)
+                        break;
+
+                    if constexpr (footer_size == 0)
+                    {
+                        /* there is no Footer to check the fragment with, the alignment is trusted once 
+                        the next Header follows right after it */
+                        if (_resync)
+                        {
+                            if ((size_t)distance(_read, write) < fragment_size + sizeof(Header))
+                                break;
+                            if (!parsers::byte_copy<Header>(fragment_start + fragment_size).is_valid(max_data_size()))
+                            {
+                                _read = fragment_start;
+                                continue;
+                            }
+                            _resync = false;
+                        }
+                    }
+
+                    /* while resynchronizing the Footer has to be checked even if we are not interested */
+                    bool accepted = is_accepted(h);
+                    if (!accepted && !_resync)
+                    {
+                        _read = _read + fragment_size;
+                        continue;
+                    }
+
+                    auto fragment_end = fragment_start + fragment_size, it = fragment_start;
+                    bytes b(fragment_size);
+                    for (uint pos = 0; pos < b.size() && it != fragment_end; ++it, ++pos)
+                        b[pos] = *it;
+
+                    if (auto f = parsers::parse_fragment<Header, Footer>(std::move(b), *this))
+                    {
+                        _read = _read + fragment_size;
+                        _resync = false;
+                        if (accepted)
+                            put_received(std::move(*f));
+                    }
+                    else
+                    {
+                        /* the Footer did not match, so the Header was most likely not a Header */
+                        _read = fragment_start;
+#ifdef SP_STREAM_WARNING
+                        std::cout << "do_receive parse failed" << std::endl;
+#endif
+                    }
+                }
+
+                return distance(_read, write);
+            }
+
+            bytes serialize_fragment(fragment && p) const 
+            {
+                if (p.data().capacity_back() < footer_size || p.data().capacity_front() < sizeof(Header))
+                    p.data().reserve(sizeof(Header), footer_size);
+                
+                /* Header */
+                p.data().push_front(to_bytes(Header(p)));
+                /* Footer */
+                if constexpr (footer_size != 0)
+                    p.data().push_back(to_bytes(Footer(p.data().begin(), p.data().end())));
+#ifdef SP_STREAM_DEBUG
+                std::cout << "serialize_fragment returning: " << p.data() << std::endl;
+#endif
+                return bytes(std::move(p.data()));
+            }
+
+            private:
+            circular_iterator _read;
+            /* set by an overflow, see the class description */
+            bool _resync = false;
+            uint _last_byte_count;
+            uint _max_fragment_size;
+        };
+    }
+}
+
+#endif
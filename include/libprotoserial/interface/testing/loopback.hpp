@@ -23,6 +23,9 @@
 #define _SP_INTERFACE_LOOPBACK
 
 #include "libprotoserial/interface/buffered.hpp"
+#include "libprotoserial/clock.hpp"
+
+#include <deque>
 
 #ifdef SP_ENABLE_IOSTREAM
 //#define SP_LOOPBACK_DEBUG
@@ -38,6 +41,16 @@
 
 namespace sp
 {
+    /* a buffer that went through a simulated channel (see sim::channel) together with the time it arrives */
+    struct channel_delivery
+    {
+        bytes data;
+        clock::time_point arrival;
+    };
+    /* whole buffer alternative to the per byte transfer_function, gets the transmitted buffer and the time 
+    of the transmit, the channel is free to corrupt, drop or insert bytes and to delay the buffer */
+    typedef std::function<channel_delivery(bytes &&, clock::time_point)> channel_function;
+
     namespace detail
     {
         template<class Header, class Footer>
@@ -57,6 +70,15 @@ namespace sp
                     parent(interface_identifier(interface_identifier::identifier_type::LOOPBACK, instance), 
                     address, broadcast_address, max_queue_size, buffer_size, max_fragment_size), _wire(wire) {}
 
+            /* use the channel to model the link as a whole, pass the sim::channel using std::ref 
+            so that its state is kept outside of the interface */
+            loopback_interface(interface_identifier::instance_type instance, interface::address_type address, interface::address_type broadcast_address,
+                uint max_queue_size, uint max_fragment_size, uint buffer_size, channel_function channel):
+                    loopback_interface(instance, address, broadcast_address, max_queue_size, max_fragment_size, buffer_size)
+            {
+                _channel = std::move(channel);
+            }
+
             protected:
 
             bool can_transmit() noexcept {return true;}
@@ -66,11 +88,30 @@ namespace sp
 #ifdef SP_LOOPBACK_DEBUG
                 std::cout << "transmit: " << buff << std::endl;
 #endif
+                if (_channel)
+                {
+                    auto d = _channel(std::move(buff), clock::now());
+                    if (d.data)
+                        _in_flight.push_back(std::move(d));
+                    return true;
+                }
                 for (auto i = buff.begin(); i < buff.end(); i++)
                     this->put_single_received(_wire(*i));
                 return true;
             }
 
+            /* deliver what has arrived from the channel so far */
+            void do_single_receive()
+            {
+                auto now = clock::now();
+                while (!_in_flight.empty() && _in_flight.front().arrival <= now)
+                {
+                    for (auto b : _in_flight.front().data)
+                        this->put_single_received(b);
+                    _in_flight.pop_front();
+                }
+            }
+
             /* this function should be implemented in the parent class, here I need to overload it to do 
             the address swap before the crc gets calculated, that's better than hacking the packet in the 
             do_transmit function */
@@ -84,13 +125,13 @@ namespace sp
 #endif
                     p.data().reserve(sizeof(Header) + parent::preamble_length, sizeof(Footer));
                 }
-                /* Header */
-                p.data().push_front(to_bytes(Header(p)));
-                /* swap the dst and the src address, this obviously 
-                only works with the 8b8b Header */
-                auto tmp = p.data()[0];
-                p.data()[0] = p.data()[1];
-                p.data()[1] = tmp;
+                /* Header with swapped dst and src address, the Header check 
+                does not depend on their order so it stays valid */
+                Header h(p);
+                typename Header::address_type tmp = h.destination;
+                h.destination = h.source;
+                h.source = tmp;
+                p.data().push_front(to_bytes(h));
                 /* preamble */
                 auto pr = bytes(parent::preamble_length);
                 pr.set(parent::preamble);
@@ -107,6 +148,8 @@ namespace sp
 
             private:
             transfer_function _wire;
+            channel_function _channel;
+            std::deque<channel_delivery> _in_flight;
         };
     }
 } // namespace sp
@@ -0,0 +1,212 @@
+/*
+ * This file is a part of the libprotoserial project
+ * https://github.com/georges-circuits/libprotoserial
+ *
+ * Copyright (C) 2022 Jiří Maňák - All Rights Reserved
+ * For contact information visit https://manakjiri.eu/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/gpl.html>
+ */
+
+#ifndef _SP_PORTS_COMPRESSION
+#define _SP_PORTS_COMPRESSION
+
+#include "libprotoserial/data/container.hpp"
+#include "libprotoserial/data/prealloc_size.hpp"
+
+#include <optional>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+
+namespace sp
+{
+    /* the payload compression stage of the ports_handler, the encoder may keep its scratch space in the 
+    instance, so one instance serves all the ports and interfaces of the handlers that run on one thread, 
+    the decoder must not keep any state */
+    class compression
+    {
+        public:
+        virtual ~compression() = default;
+
+        /* the compressed data with the room of alloc around it, nothing when it would not be
+        any smaller than the input */
+        virtual std::optional<bytes> compress(const bytes & data, const prealloc_size & alloc) = 0;
+        /* the original data, nothing when the input is malformed or when it would be larger than max_size,
+        that is the most memory the decoder takes */
+        virtual std::optional<bytes> decompress(const bytes & data, bytes::size_type max_size) const = 0;
+    };
+
+    /* LZSS in the spirit of heatshrink, suitable for MCUs
+    FORMAT: [original size, LEB128][groups...] where each group is a control byte followed by up to 8 tokens,
+    the bits of the control byte from the LSB say what the tokens are, 0 is a literal byte and 1 a match of
+    two bytes, [offset - 1 : 12][length - min_match : 4], copied from the data decoded so far
+    the encoder finds the matches through a hash table of the last positions of 3 byte sequences, the table 
+    is a member so that nothing but the output is allocated per call, this makes the instance 4 KiB large, 
+    the decoder needs nothing beyond the output */
+    class lzss_compression : public compression
+    {
+        public:
+        static constexpr uint window_size = 4096;
+        static constexpr uint min_match = 3;
+        static constexpr uint max_match = min_match + 15;
+        /* the encoder table has 1 << hash_bits entries */
+        static constexpr uint hash_bits = 10;
+
+        std::optional<bytes> compress(const bytes & data, const prealloc_size & alloc)
+        {
+            const auto size = data.size();
+            /* the worst case is a literal for every byte and a control byte for every 8 of them */
+            auto out = alloc.create(max_size_prefix + size + size / 8 + 1);
+            auto o = out.begin();
+            o = put_size(o, size);
+
+            _table.fill(0);
+            auto in = data.begin();
+            bytes::iterator control = out.end();
+            uint token = 8;
+            for (bytes::size_type i = 0; i < size;)
+            {
+                if (token == 8)
+                {
+                    control = o++;
+                    *control = 0;
+                    token = 0;
+                }
+
+                bytes::size_type length = 0, offset = 0;
+                if (i + min_match <= size)
+                {
+                    auto & slot = _table[hash(in + i)];
+                    /* the table holds position + 1 so that 0 is empty */
+                    if (slot != 0 && i - (slot - 1) <= window_size)
+                    {
+                        auto candidate = slot - 1;
+                        auto limit = std::min<bytes::size_type>(max_match, size - i);
+                        while (length < limit && in[candidate + length] == in[i + length])
+                            ++length;
+                        offset = i - candidate;
+                    }
+                    slot = i + 1;
+                }
+
+                if (length >= min_match)
+                {
+                    *control |= static_cast<byte>(1 << token);
+                    *o++ = static_cast<byte>((offset - 1) >> 4);
+                    *o++ = static_cast<byte>(((offset - 1) & 0x0f) << 4 | (length - min_match));
+                    /* the positions inside the match are worth remembering as well */
+                    for (auto j = i + 1; j < i + length && j + min_match <= size; ++j)
+                        _table[hash(in + j)] = j + 1;
+                    i += length;
+                }
+                else
+                    *o++ = in[i++];
+                ++token;
+
+                /* the output would not be smaller, give up early */
+                if (static_cast<bytes::size_type>(o - out.begin()) >= size)
+                    return std::nullopt;
+            }
+
+            if (static_cast<bytes::size_type>(o - out.begin()) >= size)
+                return std::nullopt;
+            out.shrink(0, out.end() - o);
+            return out;
+        }
+
+        std::optional<bytes> decompress(const bytes & data, bytes::size_type max_size) const
+        {
+            auto in = data.begin(), end = data.end();
+            bytes::size_type size = 0;
+            if (!get_size(in, end, size) || size > max_size)
+                return std::nullopt;
+
+            bytes out(size);
+            bytes::size_type o = 0;
+            while (o < size)
+            {
+                if (in == end)
+                    return std::nullopt;
+                auto control = *in++;
+                for (uint token = 0; token < 8 && o < size; ++token)
+                {
+                    if ((control & (1 << token)) == 0)
+                    {
+                        if (in == end)
+                            return std::nullopt;
+                        out[o++] = *in++;
+                        continue;
+                    }
+
+                    if (end - in < 2)
+                        return std::nullopt;
+                    bytes::size_type offset = (static_cast<bytes::size_type>(in[0]) << 4 | in[1] >> 4) + 1;
+                    bytes::size_type length = (in[1] & 0x0f) + min_match;
+                    in += 2;
+                    if (offset > o || length > size - o)
+                        return std::nullopt;
+                    /* the source may overlap the destination, that is how runs are encoded */
+                    for (bytes::size_type j = 0; j < length; ++j, ++o)
+                        out[o] = out[o - offset];
+                }
+            }
+            if (in != end)
+                return std::nullopt;
+            return out;
+        }
+
+        private:
+        /* scratch space of compress(), it does not carry anything over between the calls */
+        std::array<std::uint32_t, 1u << hash_bits> _table;
+
+        /* LEB128 of a 32 bit size */
+        static constexpr bytes::size_type max_size_prefix = 5;
+
+        static bytes::iterator put_size(bytes::iterator o, bytes::size_type size)
+        {
+            do
+            {
+                byte b = size & 0x7f;
+                size >>= 7;
+                *o++ = size != 0 ? (b | 0x80) : b;
+            }
+            while (size != 0);
+            return o;
+        }
+
+        static bool get_size(bytes::const_iterator & in, bytes::const_iterator end, bytes::size_type & size)
+        {
+            size = 0;
+            for (uint shift = 0; shift < 7 * max_size_prefix; shift += 7)
+            {
+                if (in == end)
+                    return false;
+                auto b = *in++;
+                size |= static_cast<bytes::size_type>(b & 0x7f) << shift;
+                if ((b & 0x80) == 0)
+                    return true;
+            }
+            return false;
+        }
+
+        static uint hash(bytes::const_iterator p)
+        {
+            std::uint32_t v = static_cast<std::uint32_t>(p[0]) << 16 | static_cast<std::uint32_t>(p[1]) << 8 | p[2];
+            return (v * 2654435761u) >> (32 - hash_bits);
+        }
+    };
+}
+
+#endif
@@ -30,25 +30,34 @@ namespace sp
 {
     namespace headers
     {
+        /* the flags byte tells the receiver how to treat the data (see ports_handler::enable_compression()), 
+        it is a part of every packet so a peer that predates it cannot talk to this one */
         struct __attribute__ ((__packed__)) ports_8b
         {
             typedef std::uint8_t        port_type;
+            typedef std::uint8_t        flags_type;
+
+            /* the data is compressed, see ports_handler::enable_compression() */
+            static constexpr flags_type COMPRESSED = 0x01;
 
             port_type destination = 0;
             port_type source = 0;
+            flags_type flags = 0;
             byte check = (byte)0;
 
             ports_8b() = default;
-            ports_8b(port_type dst, port_type src):
-                destination(dst), source(src)
+            ports_8b(port_type dst, port_type src, flags_type f = 0):
+                destination(dst), source(src), flags(f)
             {
-                check = (byte)(destination + source);
+                check = (byte)(destination + source + flags);
             }
 
             bool is_valid() const 
             {
-                return check == (byte)(destination + source) && destination && source;
+                return check == (byte)(destination + source + flags) && destination && source;
             }
+
+            bool is_compressed() const {return (flags & COMPRESSED) != 0;}
         };
     }
 }
@@ -43,7 +43,10 @@ namespace sp
 
         packet_metadata(transfer_metadata & tm, port_type src_port, port_type dst_port) :
             packet_metadata(tm.source(), tm.destination(), tm.interface_id(), tm.timestamp_creation(), tm.get_id(),
-            tm.get_prev_id(), src_port, dst_port) {}
+            tm.get_prev_id(), src_port, dst_port) 
+        {
+            set_priority(tm.get_priority());
+        }
 
         packet_metadata():
             transfer_metadata(), _src_port(invalid_port), _dst_port(invalid_port) {}
@@ -54,12 +57,19 @@ namespace sp
         constexpr void set_source_port(port_type p) {_src_port = p;}
         constexpr void set_destination_port(port_type p) {_dst_port = p;}
 
+        /* asks the ports_handler to compress the data of this packet, see ports_handler::enable_compression() */
+        constexpr bool is_compressible() const {return _compressible;}
+        constexpr void set_compressible(bool c) {_compressible = c;}
+
         packet_metadata create_response_packet_metadata() const
         {
-            return packet_metadata(destination(), source(), interface_id(), 
-                clock::now(), global_id_factory.new_id(interface_id()), get_id(), 
+            packet_metadata pm(destination(), source(), interface_id(), 
+                coarse_clock::now(), global_id_factory.new_id(interface_id()), get_id(), 
                 destination_port(), source_port()
             );
+            pm.set_priority(get_priority());
+            pm.set_compressible(is_compressible());
+            return pm;
         }
 
         constexpr bool is_response_packet(const packet_metadata & pm) const 
@@ -83,6 +93,7 @@ namespace sp
 
         protected:
         port_type _src_port, _dst_port;
+        bool _compressible = false;
     };
 
     struct packet : public packet_metadata
@@ -95,8 +106,7 @@ namespace sp
             packet_metadata(std::move(pm)), _data(std::move(d)) {}
 
         packet(transfer && t, port_type src_port = 0, port_type dst_port = 0) :
-            packet_metadata(t.source(), t.destination(), t.interface_id(), t.timestamp_creation(), 
-            t.get_id(), t.get_prev_id(), src_port, dst_port), _data(std::move(t.data())) {}
+            packet_metadata(t, src_port, dst_port), _data(std::move(t.data())) {}
         
         template<typename Header>
         packet(transfer && t, const Header & h) :
@@ -27,6 +27,7 @@
 #include "libprotoserial/fragmentation.hpp"
 #include "libprotoserial/ports/headers.hpp"
 #include "libprotoserial/ports/packet.hpp"
+#include "libprotoserial/ports/compression.hpp"
 
 #include <list>
 #include <algorithm>
@@ -68,6 +69,17 @@ namespace sp
         using Header = headers::ports_8b;
         using port_type = packet::port_type;
 
+        struct compression_configuration
+        {
+            /* shorter data is sent as it is, the compression would not pay for itself */
+            bytes::size_type min_size = 32;
+            /* compress the data of every packet, not only of those marked with packet::set_compressible() */
+            bool all_packets = false;
+            /* received data which would decompress to more than this is dropped, this bounds the memory 
+            the decoder takes */
+            bytes::size_type max_size = 4096;
+        };
+
         class service_endpoint
         {
             ports_handler & _handler;
@@ -120,6 +132,8 @@ namespace sp
         std::list<service_endpoint> _services;
         std::list<interface_endpoint> _interfaces;
         prealloc_size _prealloc;
+        compression * _compression = nullptr;
+        compression_configuration _compression_config;
 
         auto _find_service(const port_type port) const
         {
@@ -148,7 +162,18 @@ namespace sp
                     {
                         /* hide the header and forward the transfer to the registered service */
                         t.data().shrink(sizeof(Header), 0);
-                        pw->receive_event.emit(packet(std::move(t), h));
+                        if (h.is_compressed())
+                        {
+                            /* we cannot do anything with data we are not able to decompress */
+                            auto d = _compression ? _compression->decompress(t.data(), _compression_config.max_size) : std::nullopt;
+                            if (!d)
+                                return;
+                            t.data() = std::move(*d);
+                        }
+                        /* so that the response gets compressed as well */
+                        packet p(std::move(t), h);
+                        p.set_compressible(h.is_compressed());
+                        pw->receive_event.emit(std::move(p));
                     }
                 }
             }
@@ -170,7 +195,19 @@ namespace sp
             p.set_source_port(source);
             if (p.is_transmit_ready())
             {
-                Header h(p.destination_port(), p.source_port());
+                Header::flags_type flags = 0;
+                if (_compression && (_compression_config.all_packets || p.is_compressible()) && 
+                    p.data().size() >= _compression_config.min_size)
+                {
+                    /* the data stays as it is when it does not get any smaller */
+                    if (auto d = _compression->compress(p.data(), get_minimum_prealloc()))
+                    {
+                        p.data() = std::move(*d);
+                        flags |= Header::COMPRESSED;
+                    }
+                }
+
+                Header h(p.destination_port(), p.source_port(), flags);
                 p.data().push_front(to_bytes(h));
 
                 auto i = _find_interface(p.interface_id());
@@ -183,6 +220,25 @@ namespace sp
             }
         }
 
+        /* from now on the data of the transmitted packets goes through c (see compression_configuration 
+        for which ones), the received compressed data is decompressed by it, c is not copied so it must outlive the handler */
+        void enable_compression(compression & c, compression_configuration config)
+        {
+            _compression = &c;
+            _compression_config = config;
+        }
+
+        void enable_compression(compression & c)
+        {
+            enable_compression(c, compression_configuration());
+        }
+
+        /* the received compressed data is dropped from now on */
+        void disable_compression()
+        {
+            _compression = nullptr;
+        }
+
         /* use this to register a new interface, bind events and callbacks within the
         returned interface_endpoint object to a fragmentation layer */
         [[nodiscard]] interface_endpoint & register_interface(interface_identifier iid)
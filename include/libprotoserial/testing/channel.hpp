@@ -0,0 +1,169 @@
+#ifndef _SP_TESTING_CHANNEL
+#define _SP_TESTING_CHANNEL
+
+#include "libprotoserial/interface/testing/loopback.hpp"
+#include "libprotoserial/utils/bit_rate.hpp"
+
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+namespace sim
+{
+    /* deterministic channel model, every random decision comes from a single seeded engine so
+    a given seed and sequence of transfers always produces the same result. the stages are applied 
+    to whole buffers in this order: burst bit errors, byte drops and insertions, bandwidth and delay */
+    class channel
+    {
+    public:
+        struct configuration
+        {
+            /* Gilbert-Elliott burst error model, the channel is either in the good or in the bad 
+            state, the transition probabilities and the bit error rates are per bit */
+            double good_to_bad = 0;
+            double bad_to_good = 1;
+            double good_ber = 0;
+            double bad_ber = 0;
+            /* probability that a byte is lost or that a random byte appears after it */
+            double drop_rate = 0;
+            double insert_rate = 0;
+            /* propagation delay, jitter is added uniformly from [0, jitter] */
+            sp::clock::duration delay = sp::clock::duration(0);
+            sp::clock::duration jitter = sp::clock::duration(0);
+            /* transfers are serialized at this rate and queue up behind each other, 0 means unlimited */
+            sp::bit_rate bandwidth = 0;
+        };
+
+        /* simple independent bit errors */
+        static configuration with_ber(double ber)
+        {
+            configuration c;
+            c.good_ber = ber;
+            return c;
+        }
+
+        /* bursts of errors with an average length of burst_length bits that start on average every 
+        burst_interval bits, errors inside the burst occur with the burst_ber probability */
+        static configuration with_bursts(double burst_interval, double burst_length, double burst_ber = 0.5)
+        {
+            configuration c;
+            c.good_to_bad = 1.0 / burst_interval;
+            c.bad_to_good = 1.0 / burst_length;
+            c.bad_ber = burst_ber;
+            return c;
+        }
+
+        channel(configuration config, std::uint_fast64_t seed = 1) :
+            _config(config), _engine(seed), _bad(false), _busy_until(sp::never()), _last_arrival(sp::never()) {}
+
+        /* passes the buffer through the channel, data transmitted at the time point now 
+        arrives at the returned time point, arrivals never overtake each other */
+        sp::channel_delivery operator()(sp::bytes && data, sp::clock::time_point now)
+        {
+            auto size = data.size();
+            /* the errors are applied in place */
+            data.detach();
+            apply_bit_errors(data);
+            apply_drops_and_insertions(data);
+
+            auto start = std::max(now, _busy_until);
+            auto arrival = start;
+            if (_config.bandwidth != 0)
+            {
+                _busy_until = start + _config.bandwidth.bit_period() * 8 * size;
+                arrival = _busy_until;
+            }
+            arrival += _config.delay;
+            if (_config.jitter.count() > 0)
+                arrival += sp::clock::duration(std::uniform_int_distribution<sp::clock::rep>(0, _config.jitter.count())(_engine));
+            
+            _last_arrival = arrival = std::max(arrival, _last_arrival);
+            return sp::channel_delivery{std::move(data), arrival};
+        }
+
+        /* statistics over the lifetime of the channel */
+        std::uint64_t flipped_bits() const {return _flipped;}
+        std::uint64_t dropped_bytes() const {return _dropped;}
+        std::uint64_t inserted_bytes() const {return _inserted;}
+
+        const configuration & get_config() const {return _config;}
+
+    private:
+        configuration _config;
+        std::mt19937_64 _engine;
+        bool _bad;
+        sp::clock::time_point _busy_until, _last_arrival;
+        std::uint64_t _flipped = 0, _dropped = 0, _inserted = 0;
+
+        /* number of bits until an event of probability p happens (the event included), 
+        returns max for p == 0 so that it never happens */
+        std::uint64_t until(double p)
+        {
+            if (p <= 0)
+                return std::numeric_limits<std::uint64_t>::max();
+            if (p >= 1)
+                return 1;
+            return std::geometric_distribution<std::uint64_t>(p)(_engine) + 1;
+        }
+
+        void apply_bit_errors(sp::bytes & data)
+        {
+            if (_config.good_ber <= 0 && _config.bad_ber <= 0)
+                return;
+
+            /* instead of rolling a die for every bit we skip straight to the next event, which 
+            is either a bit error or a state transition, whichever comes first */
+            std::uint64_t bits = data.size() * 8, pos = 0;
+            while (pos < bits)
+            {
+                auto to_transition = until(_bad ? _config.bad_to_good : _config.good_to_bad);
+                auto to_error = until(_bad ? _config.bad_ber : _config.good_ber);
+                /* neither happens within this buffer, the distances are memoryless
+                so they can be drawn again for the next one */
+                if (std::min(to_error, to_transition) > bits - pos)
+                    break;
+                
+                if (to_error <= to_transition)
+                {
+                    pos += to_error;
+                    data[(pos - 1) / 8] ^= (sp::byte)(1 << ((pos - 1) % 8));
+                    ++_flipped;
+                }
+                else
+                {
+                    pos += to_transition;
+                    _bad = !_bad;
+                }
+            }
+        }
+
+        void apply_drops_and_insertions(sp::bytes & data)
+        {
+            if (_config.drop_rate <= 0 && _config.insert_rate <= 0)
+                return;
+
+            std::bernoulli_distribution drop(_config.drop_rate), insert(_config.insert_rate);
+            std::uniform_int_distribution<int> value(0, 255);
+            std::vector<sp::byte> out;
+            out.reserve(data.size());
+            for (auto b : data)
+            {
+                if (_config.drop_rate > 0 && drop(_engine))
+                    ++_dropped;
+                else
+                    out.push_back(b);
+                
+                if (_config.insert_rate > 0 && insert(_engine))
+                {
+                    out.push_back((sp::byte)value(_engine));
+                    ++_inserted;
+                }
+            }
+            data = sp::bytes(out.size());
+            std::copy(out.begin(), out.end(), data.begin());
+        }
+    };
+}
+
+#endif
@@ -1,130 +1,202 @@
-
 #include "libprotoserial/interface.hpp"
 #include "libprotoserial/utils/bit_rate.hpp"
 #include "libprotoserial/utils/observer.hpp"
+#include "libprotoserial/testing/channel.hpp"
 
-#include <thread>
-#include <mutex>
 #include <queue>
 #include <array>
-#include <atomic>
+#include <vector>
+#include <functional>
 
 namespace sim
 {
-    class loop_thread
+    /* discrete-event simulator with a virtual clock, nothing happens in between events so the 
+    simulation runs as fast as the events can be processed and always produces the same result. 
+    events scheduled for the same time point run in the order in which they were scheduled */
+    class scheduler
     {
-        std::function<void(void)> _fn;
-        std::jthread _thread;
-        std::atomic<bool> _run = true;
+    public:
+        using time_point = sp::clock::time_point;
+        using duration = sp::clock::duration;
+        using event_type = std::function<void(void)>;
 
-        void callback()
+    private:
+        struct event
         {
-            while (!_run)
-                ;
-            while (_run)
+            time_point time;
+            std::uint64_t sequence;
+            event_type fn;
+
+            /* std::priority_queue is a max heap, we want the earliest event on top */
+            friend bool operator<(const event & a, const event & b)
             {
-                _fn();
+                return a.time != b.time ? a.time > b.time : a.sequence > b.sequence;
             }
-        }
+        };
+
+        std::priority_queue<event> _events;
+        time_point _now;
+        std::uint64_t _sequence = 0, _processed = 0;
 
     public:
-        // TODO args
-        loop_thread(std::function<void(void)> fn) : _fn(fn), _thread(std::bind(&loop_thread::callback, this)) {}
-        ~loop_thread() { join(); }
+        /* the virtual time starts one second after the epoch so that it is never equal to sp::never() */
+        scheduler() : _now(sp::never() + std::chrono::seconds(1)) {}
 
-        void join()
+        time_point now() const {return _now;}
+
+        /* makes the scheduler the sp::clock source, so that everything in the stack follows 
+        the virtual time, the returned object restores the previous source when it is destroyed */
+        [[nodiscard]] sp::clock_override use_as_clock()
         {
-            if (_run)
-            {
-                _run = false;
-                _thread.join();
-            }
+            return sp::clock_override([this](){return _now;});
         }
-    };
 
-    template <std::size_t N>
-    class wire
-    {
-    public:
-        std::array<sp::subject<sp::byte>, N> receive_events;
+        std::uint64_t processed_count() const {return _processed;}
+        bool empty() const {return _events.empty();}
 
-    protected:
-        /* queue for each endpoint, the put function fills these queues,
-        single_callback dispatches the data byte-by-byte through receive_events */
-        std::array<std::queue<sp::byte>, N> _endpoints;
+        void at(time_point time, event_type fn)
+        {
+            _events.push(event{std::max(time, _now), _sequence++, std::move(fn)});
+        }
 
-        virtual void dispatch() = 0;
+        void after(duration delay, event_type fn)
+        {
+            at(_now + delay, std::move(fn));
+        }
 
-    private:
-        loop_thread _thread;
-        std::mutex _endpoint_mutex;
-        sp::bit_rate _rate;
+        /* calls fn every period starting now, this is how the main_task of the nodes is run */
+        void every(duration period, event_type fn)
+        {
+            repeat(_now, period, std::move(fn));
+        }
 
-        void callback()
+        /* runs the earliest event, returns false when there is nothing to run */
+        bool step()
         {
-            // std::cout << "callback lock" << std::endl;
-            _endpoint_mutex.lock();
-            dispatch();
-            // std::cout << "callback unlock" << std::endl;
-            _endpoint_mutex.unlock();
-            std::this_thread::sleep_for(_rate.bit_period() * 8);
+            if (_events.empty())
+                return false;
+            
+            /* the event can schedule other events, so it has to be moved out of the queue first */
+            auto e = std::move(const_cast<event&>(_events.top()));
+            _events.pop();
+            _now = e.time;
+            ++_processed;
+            e.fn();
+            return true;
         }
 
-    public:
-        wire(sp::bit_rate rate) : _thread(std::bind(&wire<N>::callback, this)), _rate(rate) {}
+        /* runs all events up to and including the time point, then advances the clock to it */
+        void run_until(time_point time)
+        {
+            while (!_events.empty() && _events.top().time <= time)
+                step();
+            _now = std::max(_now, time);
+        }
 
-        void put(std::size_t origin, sp::byte data)
+        void run_for(duration d)
         {
-            const std::lock_guard<std::mutex> lock(_endpoint_mutex);
-            for (std::size_t i = 0; i < N; ++i)
-            {
-                if (i != origin)
-                    _endpoints.at(i).push(data);
-            }
+            run_until(_now + d);
         }
 
-        void put(std::size_t origin, const sp::bytes &data)
+        /* runs until the condition is met, but for at most the duration d, returns the condition */
+        bool run_until(std::function<bool(void)> condition, duration d)
         {
-            // std::cout << "put lock" << std::endl;
-            const std::lock_guard<std::mutex> lock(_endpoint_mutex);
-            for (std::size_t i = 0; i < N; ++i)
+            auto limit = _now + d;
+            while (!condition() && !_events.empty() && _events.top().time <= limit)
+                step();
+            if (!condition())
             {
-                if (i != origin)
-                {
-                    for (auto d : data)
-                        _endpoints.at(i).push(d);
-                }
+                _now = std::max(_now, limit);
+                return false;
             }
-            // std::cout << "put unlock" << std::endl;
+            return true;
         }
 
-        void stop()
+    private:
+        void repeat(time_point time, duration period, event_type fn)
         {
-            _thread.join();
+            at(time, [this, period, fn = std::move(fn)]() mutable {
+                fn();
+                repeat(_now + period, period, std::move(fn));
+            });
         }
     };
 
+    /* N endpoints sharing a medium where each endpoint can transmit independently (full duplex),
+    bytes are serialized at the given bit rate and each one is delivered to all other endpoints 
+    through the receive_events as a separate event at the time its last bit arrives */
     template <std::size_t N>
-    class fullduplex : public wire<N>
+    class fullduplex
     {
-        void dispatch()
+    public:
+        std::array<sp::subject<sp::byte>, N> receive_events;
+
+        fullduplex(scheduler & s, sp::bit_rate rate) : _scheduler(s), _rate(rate) 
+        {
+            _busy_until.fill(sp::never());
+        }
+
+        /* the channel is applied to everything received by the endpoint, pass 
+        the sim::channel using std::ref to keep its state outside of the wire */
+        void set_channel(std::size_t endpoint, sp::channel_function channel)
+        {
+            _channels.at(endpoint) = std::move(channel);
+        }
+
+        /* time it takes to transmit a single byte */
+        scheduler::duration byte_period() const
+        {
+            return _rate.bit_period() * 8;
+        }
+
+        /* true while the endpoint is still transmitting the previously put data */
+        bool is_busy(std::size_t origin) const
+        {
+            return _busy_until.at(origin) > _scheduler.now();
+        }
+
+        void put(std::size_t origin, sp::byte data)
+        {
+            put(origin, sp::bytes{data});
+        }
+
+        /* data put while the endpoint is still transmitting gets queued behind the previous data */
+        void put(std::size_t origin, const sp::bytes & data)
         {
+            auto start = std::max(_scheduler.now(), _busy_until.at(origin));
+            _busy_until.at(origin) = start + byte_period() * data.size();
+
             for (std::size_t i = 0; i < N; ++i)
             {
-                if (!this->_endpoints.at(i).empty())
+                if (i == origin)
+                    continue;
+
+                if (_channels.at(i))
                 {
-                    this->receive_events.at(i).emit(this->_endpoints.at(i).front());
-                    this->_endpoints.at(i).pop();
+                    auto d = _channels.at(i)(sp::bytes(data), start);
+                    schedule(i, d.data, d.arrival);
                 }
+                else
+                    schedule(i, data, start);
             }
         }
 
-    public:
-        ~fullduplex()
+    private:
+        scheduler & _scheduler;
+        sp::bit_rate _rate;
+        std::array<scheduler::time_point, N> _busy_until;
+        std::array<sp::channel_function, N> _channels;
+
+        void schedule(std::size_t endpoint, const sp::bytes & data, scheduler::time_point start)
         {
-            this->stop();
+            auto arrival = start;
+            for (auto b : data)
+            {
+                arrival += byte_period();
+                _scheduler.at(arrival, [this, endpoint, b](){
+                    receive_events.at(endpoint).emit(b);
+                });
+            }
         }
-
-        using wire<N>::wire;
     };
 }
@@ -56,17 +56,17 @@ class kiss_protocol
 
         data_handle(byte type, bytes data, fragment::address_type addr) :
             type(type), id(++id_counter), data(std::move(data)), 
-            addr(addr), retries(0), sent_at(clock::now()) {}
+            addr(addr), retries(0), sent_at(coarse_clock::now()) {}
 
         void sent()
         {
-            sent_at = clock::now();
+            sent_at = coarse_clock::now();
             ++retries;
         }
 
         bool transmit_expired(clock::duration holdoff) const
         {
-            return sent_at + holdoff <= clock::now();
+            return sent_at + holdoff <= coarse_clock::now();
         }
 
         bool retries_exhausted(uint retries_max) const
@@ -89,7 +89,7 @@ class kiss_protocol
     fragment::address_type default_addr;
 
     clock::duration ping_holdoff {};
-    clock::time_point last_transmitted {clock::now()}, last_received {never()};
+    clock::time_point last_transmitted {coarse_clock::now()}, last_received {never()};
 
     void receive(fragment f)
     {
@@ -98,11 +98,11 @@ class kiss_protocol
             byte type = f.data().at(0);
             byte id = f.data().at(1);
 
-            last_received = clock::now();
+            last_received = coarse_clock::now();
 
             if (type != 0)
             {
-                last_transmitted = clock::now();
+                last_transmitted = coarse_clock::now();
 
                 /* transmit the ACK fragment */
                 fragment resp(f.source(), bytes({(byte)ACK_TYPE, id}));
@@ -132,7 +132,7 @@ class kiss_protocol
 
     bool transmit_packet(const data_handle & p)
     {
-        last_transmitted = clock::now();
+        last_transmitted = coarse_clock::now();
 
         auto data = _interface.minimum_prealloc().create(0, 2, p.data.size());
         data[0] = p.type;
@@ -179,6 +179,7 @@ class kiss_protocol
 
     void main_task()
     {
+        coarse_clock::update();
         for (auto it = packet_list.begin(); it != packet_list.end(); ++it)
         {
             if (it->transmit_expired(retry_holdoff))
@@ -198,7 +199,7 @@ class kiss_protocol
             }
         }
 
-        if (ping_holdoff != clock::duration{} && last_transmitted + ping_holdoff <= clock::now())
+        if (ping_holdoff != clock::duration{} && last_transmitted + ping_holdoff <= coarse_clock::now())
         {
             /* transmit the PING, since it behaves like a normal packet,
             it should get ACKed, which will update last_received */
@@ -218,7 +219,7 @@ class kiss_protocol
 
     bool is_peer_alive(clock::duration additional_holdoff = clock::duration{}) const
     {
-        return last_received + (ping_holdoff + additional_holdoff + (retry_holdoff * retries_max)) > clock::now();
+        return last_received + (ping_holdoff + additional_holdoff + (retry_holdoff * retries_max)) > coarse_clock::now();
     }
 
 };
@@ -89,10 +89,23 @@ namespace sp
             }), _callbacks.end());
         }
 
+        /* true if there is at least one subscriber, use this to skip work whose only purpose is to emit */
+        bool has_subscribers() const
+        {
+            return !_callbacks.empty();
+        }
+
+        /* every subscriber gets its own copy of the arguments except for the last one, which gets 
+        them moved, with a single subscriber this saves a copy and preserves the sp_object IDs */
         constexpr void emit(Args... arg) const
         {
-            for (auto& c : _callbacks)
-                std::get<0>(c)(arg...);
+            for (auto itr = _callbacks.begin(); itr != _callbacks.end(); ++itr)
+            {
+                if (std::next(itr) == _callbacks.end())
+                    std::get<0>(*itr)(std::move(arg)...);
+                else
+                    std::get<0>(*itr)(arg...);
+            }
         }
 
         private:
@@ -27,6 +27,8 @@
 #include <tuple>
 #include <atomic>
 
+#include <sys/socket.h>
+
 #include "gtest/gtest.h"
 
 using namespace std;
@@ -387,6 +389,38 @@ TEST(Utils, BitRate)
     EXPECT_EQ(rate25000.bit_period(), 40us) << "sub-millisecond clock";
 }
 
+TEST(Utils, Clock)
+{
+    auto before = sp::clock::now();
+    {
+        sp::manual_clock mc;
+        auto t = sp::clock::now();
+        EXPECT_EQ(t, mc.now());
+        EXPECT_FALSE(sp::older_than(t, 1h));
+        mc.advance(1h + 1ms);
+        EXPECT_TRUE(sp::older_than(t, 1h));
+        EXPECT_EQ(sp::coarse_clock::now(), mc.now());
+
+        /* the scheduler takes over for as long as the override lives */
+        sim::scheduler scheduler;
+        {
+            auto o = scheduler.use_as_clock();
+            scheduler.run_for(10min);
+            EXPECT_EQ(sp::clock::now(), scheduler.now());
+            /* the coarse time only moves with the main_task */
+            EXPECT_LT(sp::coarse_clock::now(), scheduler.now());
+            /* the transfers made outside of the main_task take the precise time */
+            EXPECT_EQ(sp::transfer(sp::interface_identifier(sp::interface_identifier::NONE, 0), 2).timestamp_creation(), scheduler.now());
+            sp::loopback_interface lo(0, 1, 255, 10, 64, 256);
+            lo.main_task();
+            EXPECT_EQ(sp::coarse_clock::now(), scheduler.now());
+        }
+        EXPECT_EQ(sp::clock::now(), mc.now());
+    }
+    /* back to the system clock */
+    EXPECT_GE(sp::clock::now(), before);
+}
+
 
 
 
@@ -482,12 +516,201 @@ TEST(Interface, HeavilyCorruptedRandom)
     EXPECT_TRUE(test_interface(interface, 10000, data, addr) > 0);
 }
 
+TEST(Interface, Channel)
+{
+    /* the same seed has to produce the same losses */
+    auto run = [](std::uint_fast64_t seed){
+        sim::channel ch(sim::channel::with_bursts(10000, 20), seed);
+        sp::loopback_interface interface(0, 1, 255, 10, 64, 256, std::ref(ch));
+        std::srand(seed);
+        auto data = [&](){return random_bytes(1, interface.max_data_size());};
+        auto addr = [&](){return random(2, 100);};
+        auto received = test_interface(interface, 2000, data, addr);
+        EXPECT_GT(ch.flipped_bits(), 0);
+        return received;
+    };
+    auto first = run(42);
+    EXPECT_LT(first, 2000);
+    EXPECT_GT(first, 0);
+    EXPECT_EQ(first, run(42));
+
+    /* delay and bandwidth, the fragment must not arrive before its time */
+    sim::channel::configuration c;
+    c.delay = 5ms;
+    c.bandwidth = 115200;
+    sim::channel ch(c);
+    sp::loopback_interface interface(0, 1, 255, 10, 64, 256, std::ref(ch));
+    uint received = 0;
+    interface.receive_event.subscribe([&](sp::fragment){ ++received; });
+    
+    auto start = sp::clock::now();
+    interface.transmit(sp::fragment(2, random_bytes(50)));
+    interface.main_task();
+    EXPECT_EQ(received, 0);
+    while (received == 0 && !sp::older_than(start, 100ms))
+        interface.main_task();
+    EXPECT_EQ(received, 1);
+    EXPECT_TRUE(sp::older_than(start, 5ms + sp::bit_rate(115200).bit_period() * 8 * 50));
+}
+
+TEST(Interface, WideHeader)
+{
+    /* the narrow header cannot describe more than 255 bytes regardless of the configured fragment size */
+    sp::loopback_interface narrow(0, 1, 255, 10, 1024, 4096);
+    EXPECT_EQ(narrow.max_data_size(), 255);
+
+    sp::wide_loopback_interface interface(1, 1000, 0xffff, 10, 4096, 16384);
+    EXPECT_EQ(interface.max_data_size(), 4096 - (sizeof(sp::headers::interface_16b16b) + sizeof(sp::footers::crc32) + 2));
+
+    auto data = [&](){return random_bytes(1, interface.max_data_size());};
+    auto addr = [&](){return random(1001, 60000);};
+
+    EXPECT_EQ(test_interface(interface, 500, data, addr), 500);
+}
+
+
+class raw_stream_interface : public sp::detail::stream_parser_interface<sp::headers::interface_8b8b, sp::footers::none>
+{
+    public:
+    using stream_parser_interface::stream_parser_interface;
+    void put(const sp::bytes & b) {for (auto x : b) put_single_received(x);}
+
+    protected:
+    bool can_transmit() noexcept {return false;}
+    bool do_transmit(sp::bytes &&) noexcept {return false;}
+};
+
+TEST(Interface, Stream)
+{
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    {
+        sp::stream_interface i1(fds[0], 0, 1, 255, 10, 64, 1024), i2(fds[1], 1, 2, 255, 10, 64, 1024);
+        /* no preamble, just the Header and the crc */
+        EXPECT_EQ(i1.max_data_size(), 64 - (sizeof(sp::headers::interface_8b8b) + sizeof(sp::footers::crc32)));
+
+        std::vector<sp::bytes> received;
+        i2.receive_event.subscribe([&](sp::fragment f){ received.push_back(f.data()); });
+
+        /* queue several fragments before the receiver gets to run, they all get parsed in one go */
+        std::vector<sp::bytes> sent;
+        for (int i = 0; i < 10; ++i)
+        {
+            sent.push_back(random_bytes(1, i1.max_data_size()));
+            i1.transmit(sp::fragment(2, sent.back()));
+            i1.main_task();
+        }
+        i2.main_task();
+        ASSERT_EQ(received.size(), sent.size());
+        /* the level is sampled before the parsing drains the buffer */
+        EXPECT_GT(i2.get_status().receive_buffer_level, sent.size() * sizeof(sp::headers::interface_8b8b));
+        for (uint i = 0; i < sent.size(); ++i)
+            EXPECT_TRUE(received.at(i) == sent.at(i));
+    }
+    {
+        /* trusted transport without the crc */
+        sp::detail::pc::stream_interface<sp::headers::interface_16b16b, sp::footers::none> 
+            i1(fds[0], 0, 1, 0xffff, 10, 2048, 8192), i2(fds[1], 1, 2, 0xffff, 10, 2048, 8192);
+        EXPECT_EQ(i1.max_data_size(), 2048 - sizeof(sp::headers::interface_16b16b));
+
+        auto data = [&](){return random_bytes(1, i1.max_data_size());};
+        auto addr = [&](){return 2;};
+        uint count = 0;
+        i2.receive_event.subscribe([&](sp::fragment){ ++count; });
+        for (int i = 0; i < 100; ++i)
+        {
+            i1.transmit(sp::fragment(addr(), data()));
+            i1.main_task();
+            i2.main_task();
+        }
+        EXPECT_EQ(count, 100);
+    }
+    {
+        /* after an overflow nothing is delivered until the alignment has been checked, without the crc
+        that takes a valid Header right after the fragment, a Header inside the data is not enough */
+        raw_stream_interface i2(sp::interface_identifier(sp::interface_identifier::VIRTUAL, 1), 2, 255, 10, 64, 32);
+        std::vector<sp::bytes> received;
+        i2.receive_event.subscribe([&](sp::fragment f){ received.push_back(f.data()); });
+        auto frame = [](sp::bytes data){
+            return sp::bytes{2, 1, static_cast<sp::byte>(data.size()), static_cast<sp::byte>(3 + data.size())} + data;
+        };
+        /* a file descriptor is never read past the free space, only a source that cannot be held back overflows */
+        auto send = [&](const sp::bytes & b){ i2.put(b); };
+
+        send(random_bytes(100));
+        i2.main_task();
+        EXPECT_EQ(i2.get_status().receive_buffer_level, 64);
+        std::vector<sp::bytes> sent = {random_bytes(10), random_bytes(10), random_bytes(10)};
+        /* the overflow left us in the middle of a fragment whose data looks like a fragment */
+        send(frame(sp::bytes{0xaa, 0xab, 0xac}) + sp::bytes{0, 0, 0, 0} + frame(sent[0]) + frame(sent[1]) + frame(sent[2]));
+        i2.main_task();
+        ASSERT_EQ(received.size(), sent.size());
+        for (uint i = 0; i < sent.size(); ++i)
+            EXPECT_TRUE(received.at(i) == sent.at(i));
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    /* a peer that does not read does not block the main_task, the fragments wait in the queue */
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    {
+        int size = 4096;
+        setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        sp::stream_interface i1(fds[0], 0, 1, 255, 10, 64, 1024), i2(fds[1], 1, 2, 255, 10, 64, 4096);
+        std::vector<sp::bytes> received, sent;
+        i2.receive_event.subscribe([&](sp::fragment f){ received.push_back(f.data()); });
+        for (int i = 0; i < 5000; ++i)
+        {
+            if (i1.is_writable())
+            {
+                sent.push_back(random_bytes(i1.max_data_size()));
+                i1.transmit(sp::fragment(2, sent.back()));
+            }
+            i1.main_task();
+        }
+        EXPECT_GT(i1.get_status().transmit_queue_level, 0);
+        for (int i = 0; i < 5000 && received.size() < sent.size(); ++i)
+        {
+            i1.main_task();
+            i2.main_task();
+        }
+        ASSERT_EQ(received.size(), sent.size());
+        for (uint i = 0; i < sent.size(); ++i)
+            EXPECT_TRUE(received.at(i) == sent.at(i));
+    }
+    {
+        /* the sender is far ahead of a small receive buffer, the socket holds the rest back */
+        sp::stream_interface i1(fds[0], 0, 1, 255, 10, 64, 1024), i2(fds[1], 1, 2, 255, 10, 64, 256);
+        std::vector<sp::bytes> received, sent;
+        i2.receive_event.subscribe([&](sp::fragment f){ received.push_back(f.data()); });
+        for (int i = 0; i < 1000 && received.size() < 50; ++i)
+        {
+            for (int j = 0; j < 10; ++j)
+            {
+                if (sent.size() < 50 && i1.is_writable())
+                {
+                    sent.push_back(random_bytes(i1.max_data_size()));
+                    i1.transmit(sp::fragment(2, sent.back()));
+                }
+                i1.main_task();
+            }
+            i2.main_task();
+        }
+        ASSERT_EQ(received.size(), sent.size());
+        for (uint i = 0; i < sent.size(); ++i)
+            EXPECT_TRUE(received.at(i) == sent.at(i));
+    }
+    close(fds[0]);
+    close(fds[1]);
+}
+
 
 TEST(Interface, SimpleSim)
 {
-    sim::fullduplex<2> wire(9600);
+    sim::scheduler scheduler;
+    sim::fullduplex<2> wire(scheduler, 9600);
     sp::virtual_interface interface1(0, 1, 255, 10, 256, 1024), interface2(1, 2, 255, 10, 256, 1024);
-    std::atomic<int> i1_receive = 0, i2_receive = 0;
+    int i1_receive = 0, i2_receive = 0;
 
     /* interface raw byte receive */
     wire.receive_events.at(0).subscribe([&interface1](sp::byte b){
@@ -497,42 +720,113 @@ TEST(Interface, SimpleSim)
         interface2.put_single_serialized(b);
     });
     
-    /* spinup the main task interface threads - these simulate the device context */
-    sim::loop_thread th1([&](){
-        this_thread::sleep_for(1ms);
+    /* the main tasks of the interfaces run as periodic events - these simulate the device context */
+    scheduler.every(1ms, [&](){
         if (auto b = interface1.process_and_get_serialized())
             wire.put(interface1.interface_id().instance, std::move(*b));
     });
-    sim::loop_thread th2([&](){
-        this_thread::sleep_for(1ms);
+    scheduler.every(1ms, [&](){
         if (auto b = interface2.process_and_get_serialized())
             wire.put(interface2.interface_id().instance, std::move(*b));
     });
 
     /* interface finished fragment receive event */
-    std::mutex rx_mutex;
+    sp::clock::time_point first_receive = sp::never();
     interface1.receive_event.subscribe([&](sp::fragment f){
-        const std::lock_guard<std::mutex> lock(rx_mutex);
         cout << "i" << interface1.interface_id() << ": " << f << endl;
         ++i1_receive;
     });
     interface2.receive_event.subscribe([&](sp::fragment f){
-        const std::lock_guard<std::mutex> lock(rx_mutex);
         cout << "i" << interface2.interface_id() << ": " << f << endl;
+        if (first_receive == sp::never())
+            first_receive = scheduler.now();
         ++i2_receive;
     });
 
     /* test transmits */
+    auto start = scheduler.now();
     interface1.transmit(sp::fragment(2, random_bytes(2)));
     interface1.transmit(sp::fragment(2, random_bytes(4)));
     interface2.transmit(sp::fragment(1, random_bytes(3)));
 
-    this_thread::sleep_for(300ms);
+    auto wall = sp::clock::now();
+    scheduler.run_for(300ms);
     EXPECT_EQ(i1_receive, 1);
     EXPECT_EQ(i2_receive, 2);
+
+    /* the first fragment cannot arrive sooner than its bytes take to transmit at 9600 baud */
+    auto size = 2 + sizeof(sp::headers::interface_8b8b) + sizeof(sp::footers::crc32) + 2;
+    EXPECT_GE(first_receive - start, wire.byte_period() * size);
+    EXPECT_LT(first_receive - start, wire.byte_period() * size + 2ms);
+    /* and the virtual time does not wait for the wall clock */
+    EXPECT_TRUE(!sp::older_than(wall, 100ms));
 }
 
 
+TEST(Interface, ReceiveBufferStatus)
+{
+    sp::virtual_interface interface(0, 1, 255, 10, 64, 256);
+    EXPECT_EQ(interface.get_status().receive_buffer_size, 256);
+    EXPECT_EQ(interface.get_status().receive_buffer_level, 0);
+
+    /* garbage without any preamble, the parser discards it during the main_task */
+    sp::bytes garbage(100);
+    interface.put_serialized(std::move(garbage));
+    interface.main_task();
+    EXPECT_EQ(interface.get_status().receive_buffer_level, 100);
+
+    interface.main_task();
+    EXPECT_EQ(interface.get_status().receive_buffer_level, 0);
+}
+
+TEST(Interface, DestinationFilter)
+{
+    /* interface3 is only used to serialize fragments for interface1 */
+    sp::virtual_interface interface1(0, 1, 255, 10, 64, 256), interface3(1, 3, 255, 10, 64, 256);
+    int received = 0, other = 0;
+    interface1.receive_event.subscribe([&](sp::fragment){++received;});
+
+    auto serialize = [&](sp::interface::address_type dst, sp::bytes data){
+        interface3.transmit(sp::fragment(dst, std::move(data)));
+        return *interface3.process_and_get_serialized();
+    };
+
+    /* a fragment for someone else followed by ours, both are in the buffer at once */
+    interface1.put_serialized(serialize(2, random_bytes(20)) + serialize(1, random_bytes(20)));
+    for (int i = 0; i < 3; ++i)
+        interface1.main_task();
+    EXPECT_EQ(received, 1);
+
+    /* a foreign Header in the line noise claims more bytes than follow it, it must not hide our fragments */
+    interface1.put_serialized(sp::bytes{0x55, 0x55, 2, 3, 40, 45, 1, 2, 3} + serialize(1, random_bytes(20)) + serialize(1, random_bytes(20)));
+    for (int i = 0; i < 3; ++i)
+        interface1.main_task();
+    EXPECT_EQ(received, 3);
+
+    /* once someone listens, foreign fragments are parsed again */
+    interface1.other_receive_event.subscribe([&](sp::fragment f){
+        EXPECT_EQ(f.destination(), 2);
+        ++other;
+    });
+    interface1.put_serialized(serialize(2, random_bytes(20)));
+    interface1.main_task();
+    EXPECT_EQ(other, 1);
+    EXPECT_EQ(received, 3);
+}
+
+
+/* base_fragmentation_handler with permissive policies */
+class test_fragmentation_handler : public sp::detail::base_fragmentation_handler<sp::headers::fragment_8b8b>
+{
+    public:
+    using base_fragmentation_handler::base_fragmentation_handler;
+
+    protected:
+    int transfer_transmit_priority(const transfer_handler_type &) {return 0;}
+    bool is_peer_ready_to_receive_data_fragment(const transfer_handler_type &) {return true;}
+    bool is_fragment_transmit_allowed() {return true;}
+    void bordering_fragment_response_received(const transfer_handler_type &, message_types) {}
+};
 
 TEST(Fragmentation, Headers)
 {
@@ -549,14 +843,15 @@ TEST(Fragmentation, TransferHandler)
     const sp::bytes b1 = {10_BYTE, 11_BYTE, 12_BYTE, 13_BYTE, 14_BYTE}, b2 = {20_BYTE, 21_BYTE, 22_BYTE}, b3 = {30_BYTE, 31_BYTE}, b4 = {40_BYTE};
     sp::interface_identifier iid(sp::interface_identifier::NONE, 0);
 
+    /* the first fragment carries the transfer size in front of the data */
     th::header_type header(th::header_type::message_types::FRAGMENT, 1, 1, 0, 0, 0);
-    sp::fragment f(1, b1);
-    th tr_rx(std::move(f), header);
+    sp::fragment f(1, sp::to_bytes(static_cast<th::length_type>(b1.size())) + b1);
+    th tr_rx(f, header);
 
     EXPECT_TRUE(tr_rx.data() == b1);
     EXPECT_EQ(tr_rx.get_fragments_total(), 1);
-    EXPECT_EQ(tr_rx.get_max_fragment_data_size(), b1.size());
-    EXPECT_EQ(tr_rx.fragment_size(1), b1.size());
+    EXPECT_EQ(tr_rx.get_max_fragment_data_size(), b1.size() + th::length_size);
+    EXPECT_EQ(tr_rx.fragment_size(1), b1.size() + th::length_size);
 
     /* put should fail because of the tr_rx.max_fragment_size, data should be left untouched */
     EXPECT_EQ(tr_rx.put_fragment(2, f), false);
@@ -609,7 +904,1229 @@ TEST(Fragmentation, BypassSingle)
     EXPECT_EQ(rxed, 1) << "data did not get through";
 }
 
+TEST(Fragmentation, ReceiverStatus)
+{
+    using header_type = test_fragmentation_handler::header_type;
+    using status_type = test_fragmentation_handler::status_type;
+    sp::manual_clock clock;
+
+    sp::virtual_interface vi(0, 1, 255, 10, 64, 256);
+    auto config = test_fragmentation_handler::configuration(vi);
+    config.pressure_holdoff = 1s;
+    test_fragmentation_handler fh(vi, vi.minimum_prealloc(), config);
+
+    std::vector<sp::fragment> transmitted;
+    fh.transmit_event.subscribe([&](sp::fragment f){
+        transmitted.push_back(std::move(f));
+    });
+
+    /* peer 2 tells us that its receive buffer is critically full */
+    header_type h(header_type::message_types::FRAGMENT_ACK, 1, 1, 10, 0, status_type::RX_CRITICAL);
+    fh.receive_callback(sp::fragment(2, 1, sp::to_bytes(h), vi.interface_id()));
+    EXPECT_TRUE(fh.is_peer_in_holdoff(2));
+    EXPECT_FALSE(fh.is_peer_in_holdoff(3));
+
+    /* only the transfer to the peer without pressure should go out */
+    sp::transfer t2(vi.interface_id(), 2), t3(vi.interface_id(), 3);
+    t2.data() = random_bytes(10);
+    t3.data() = random_bytes(10);
+    fh.transmit(t2);
+    fh.transmit(t3);
+    fh.main_task();
+    ASSERT_EQ(transmitted.size(), 1);
+    EXPECT_EQ(transmitted.at(0).destination(), 3);
+    auto h3 = sp::parsers::byte_copy<header_type>(transmitted.at(0).data().begin());
+    EXPECT_FALSE(h3.get_status().rx_poor());
+
+    /* fill our receive buffer, the next outgoing header should advertise the pressure */
+    vi.put_serialized(sp::bytes(200));
+    vi.main_task();
+    EXPECT_TRUE(fh.our_status().rx_critical());
+
+    sp::transfer t4(vi.interface_id(), 4);
+    t4.data() = random_bytes(10);
+    fh.transmit(t4);
+    fh.main_task();
+    ASSERT_EQ(transmitted.size(), 2);
+    EXPECT_EQ(transmitted.at(1).destination(), 4);
+    auto h4 = sp::parsers::byte_copy<header_type>(transmitted.at(1).data().begin());
+    EXPECT_TRUE(h4.get_status().rx_critical());
+
+    /* the holdoff expires */
+    clock.advance(3s - 1ms);
+    EXPECT_TRUE(fh.is_peer_in_holdoff(2));
+    clock.advance(1ms);
+    EXPECT_FALSE(fh.is_peer_in_holdoff(2));
+}
+
+
+TEST(Fragmentation, ZeroCopy)
+{
+    using th = sp::detail::transfer_handler<sp::headers::fragment_8b8b>;
+    sp::interface_identifier iid(sp::interface_identifier::VIRTUAL, 0);
+    sp::prealloc_size alloc(4, 2);
+
+    sp::transfer t(iid, 2);
+    t.data() = random_bytes(25);
+    const auto original = t.data();
+    th tr(std::move(t), 10);
+
+    /* the fragments split the transfer size followed by the data */
+    const auto stream = sp::to_bytes(static_cast<th::length_type>(original.size())) + original;
+    auto check = [&](const sp::fragment & f, uint pos){
+        EXPECT_TRUE(std::equal(f.data().begin() + sizeof(th::header_type), f.data().end(), 
+            stream.begin() + (pos - 1) * 10));
+    };
+
+    /* the fragment is a view into the transfer with room for the lower layers */
+    auto f1 = tr.get_fragment(1, alloc);
+    ASSERT_TRUE(f1);
+    EXPECT_TRUE(f1->data().is_view());
+    EXPECT_GE(f1->data().capacity_front(), 4);
+    EXPECT_GE(f1->data().capacity_back(), 2);
+    check(*f1, 1);
+    f1->data().push_front(sp::bytes(4));
+    f1->data().push_back(sp::bytes(2));
+    EXPECT_TRUE(f1->data().is_view());
+
+    /* while the lower layers hold it, the retransmit is a copy */
+    auto f1_again = tr.get_fragment(1, alloc);
+    EXPECT_FALSE(f1_again->data().is_view());
+    check(*f1_again, 1);
+
+    /* the headers written around fragment 1 did not touch its neighbours */
+    auto f2 = tr.get_fragment(2, alloc);
+    EXPECT_TRUE(f2->data().is_view());
+    check(*f2, 2);
+    auto f3 = tr.get_fragment(3, alloc);
+    EXPECT_EQ(f3->data().size(), sizeof(th::header_type) + stream.size() - 20);
+    check(*f3, 3);
+
+    f1.reset();
+    auto f1_view = tr.get_fragment(1, alloc);
+    EXPECT_TRUE(f1_view->data().is_view());
+    check(*f1_view, 1);
+
+    /* modifying a view in place requires detaching it first */
+    f1_view->data().detach();
+    f1_view->data().set(0);
+    check(*tr.get_fragment(1, alloc), 1);
+}
+
+TEST(Fragmentation, ExactReassembly)
+{
+    using th = sp::detail::transfer_handler<sp::headers::fragment_8b8b>;
+    using types = th::header_type::message_types;
+    sp::interface_identifier iid(sp::interface_identifier::VIRTUAL, 0);
+
+    sp::transfer t(iid, 2);
+    t.data() = random_bytes(45);
+    const auto original = t.data();
+    th tx(std::move(t), 10);
+    ASSERT_EQ(tx.get_fragments_total(), 5);
+
+    auto receive = [&](uint pos){
+        auto f = *tx.get_fragment(pos, sp::prealloc_size());
+        f.data().shrink(sizeof(th::header_type), 0);
+        return f;
+    };
+    auto header = [&](uint pos){
+        return th::header_type(types::FRAGMENT, pos, 5, tx.get_id(), 0, 0);
+    };
+
+    /* nothing is allocated before the size is known */
+    th rx(receive(3), header(3));
+    EXPECT_FALSE(rx.is_size_known());
+    EXPECT_EQ(rx.data().size(), 0);
+    EXPECT_TRUE(rx.put_fragment(2, receive(2)));
+    EXPECT_FALSE(rx.is_size_known());
+
+    /* the first fragment tells the size, the data is allocated exactly */
+    EXPECT_TRUE(rx.put_fragment(1, receive(1)));
+    EXPECT_TRUE(rx.is_size_known());
+    EXPECT_EQ(rx.data().size(), original.size());
+    EXPECT_EQ(rx.data().capacity(), original.size());
+
+    /* the last fragment has to agree with it */
+    auto last = receive(5);
+    last.data().shrink(0, 1);
+    EXPECT_FALSE(rx.put_fragment(5, last));
+    EXPECT_TRUE(rx.put_fragment(5, receive(5)));
+    EXPECT_TRUE(rx.put_fragment(4, receive(4)));
+    ASSERT_TRUE(rx.is_complete());
+    EXPECT_TRUE(rx.take_transfer().data() == original);
+
+    /* the last fragment implies the size just as well */
+    th rx2(receive(4), header(4));
+    EXPECT_TRUE(rx2.put_fragment(5, receive(5)));
+    EXPECT_TRUE(rx2.is_size_known());
+    EXPECT_EQ(rx2.data().size(), original.size());
+    for (uint pos : {1, 2, 3})
+        EXPECT_TRUE(rx2.put_fragment(pos, receive(pos)));
+    ASSERT_TRUE(rx2.is_complete());
+    EXPECT_TRUE(rx2.take_transfer().data() == original);
+
+    /* a size which does not match the fragment count makes the first fragment invalid */
+    auto bad = receive(1);
+    bad.data().at(0) = 100_BYTE;
+    th rx3(receive(2), header(2));
+    EXPECT_FALSE(rx3.put_fragment(1, bad));
+    EXPECT_FALSE(rx3.is_size_known());
+}
+
+TEST(Fragmentation, ParityRebuild)
+{
+    using th = sp::detail::transfer_handler<sp::headers::fragment_8b8b>;
+    using header_type = th::header_type;
+    using types = header_type::message_types;
+    sp::interface_identifier iid(sp::interface_identifier::VIRTUAL, 0);
+
+    sp::transfer t(iid, 2);
+    t.data() = random_bytes(45);
+    const auto original = t.data();
+    th tx(std::move(t), 10);
+    EXPECT_TRUE(tx.set_parity_block(3));
+
+    /* a parity follows each block, the last block is shorter */
+    std::map<uint, sp::fragment> data, parity;
+    std::vector<uint> order;
+    while (auto f = tx.get_next_fragment(10, sp::prealloc_size()))
+    {
+        auto h = sp::parsers::byte_copy<header_type>(f->data().begin());
+        f->data().shrink(sizeof(header_type), 0);
+        if (h.type() == types::FRAGMENT_PARITY)
+        {
+            EXPECT_EQ(h.get_prev_id(), h.fragment() == 1 ? 3 : 2);
+            parity.emplace(h.fragment(), std::move(*f));
+            order.push_back(100 + h.fragment());
+        }
+        else
+        {
+            data.emplace(h.fragment(), std::move(*f));
+            order.push_back(h.fragment());
+        }
+    }
+    EXPECT_EQ(order, std::vector<uint>({1, 2, 3, 101, 4, 5, 104}));
+    EXPECT_FALSE(tx.set_parity_block(2));
+    auto header = [&](uint pos){
+        return header_type(types::FRAGMENT, pos, 5, tx.get_id(), 0, 0);
+    };
+
+    /* one fragment missing from each block, they are rebuilt without a retransmit */
+    th rx(data.at(1), header(1));
+    EXPECT_TRUE(rx.put_fragment(3, data.at(3)));
+    EXPECT_TRUE(rx.put_parity(1, 3, parity.at(1)));
+    EXPECT_EQ(rx.get_rebuilt_count(), 1);
+    EXPECT_TRUE(rx.is_fragment_received(2));
+    EXPECT_TRUE(rx.put_parity(4, 2, parity.at(4)));
+    EXPECT_FALSE(rx.is_fragment_received(5));
+    EXPECT_TRUE(rx.put_fragment(4, data.at(4)));
+    EXPECT_EQ(rx.get_rebuilt_count(), 2);
+    ASSERT_TRUE(rx.is_complete());
+    EXPECT_TRUE(rx.take_transfer().data() == original);
+
+    /* the rebuilt first fragment tells the size, then the last one can be rebuilt as well */
+    th rx2(data.at(2), header(2));
+    EXPECT_TRUE(rx2.put_fragment(4, data.at(4)));
+    EXPECT_TRUE(rx2.put_parity(4, 2, parity.at(4)));
+    EXPECT_EQ(rx2.get_rebuilt_count(), 0);
+    EXPECT_TRUE(rx2.put_fragment(3, data.at(3)));
+    EXPECT_TRUE(rx2.put_parity(1, 3, parity.at(1)));
+    EXPECT_EQ(rx2.get_rebuilt_count(), 2);
+    ASSERT_TRUE(rx2.is_complete());
+    EXPECT_TRUE(rx2.take_transfer().data() == original);
+
+    /* two losses in a block need the retransmit */
+    th rx3(data.at(1), header(1));
+    EXPECT_TRUE(rx3.put_parity(1, 3, parity.at(1)));
+    EXPECT_EQ(rx3.get_rebuilt_count(), 0);
+    EXPECT_FALSE(rx3.put_parity(4, 3, parity.at(4)));
+
+    /* the handler picks the block size for the peer, from its loss rate when adaptive */
+    sp::manual_clock clock;
+    auto config = sim::channel::with_ber(0.001);
+    sim::channel ch(config, 3);
+    sp::loopback_interface lo(0, 1, 255, 10, 64, 1024, std::ref(ch));
+    auto fc = test_fragmentation_handler::configuration(lo);
+    fc.fec_adaptive = true;
+    test_fragmentation_handler fh(lo, lo.minimum_prealloc(), fc);
+    fh.bind_to(lo);
+    EXPECT_EQ(fh.fec_block(2), 0);
+    fh.set_peer_fec_block(3, 4);
+    EXPECT_EQ(fh.fec_block(3), 4);
+    fh.set_peer_fec_block(3, std::nullopt);
+    EXPECT_EQ(fh.fec_block(3), 0);
+
+    std::srand(3);
+    std::map<sp::transfer::id_type, sp::bytes> expected;
+    uint received = 0;
+    fh.transfer_receive_event.subscribe([&](sp::transfer t){
+        EXPECT_TRUE(expected.at(t.get_id()) == t.data());
+        ++received;
+    });
+    for (int i = 0; i < 30; ++i)
+    {
+        sp::transfer t(lo.interface_id(), 2);
+        t.data() = random_bytes(lo.max_data_size() * 5, lo.max_data_size() * 10);
+        expected[t.get_id()] = t.data();
+        fh.transmit(t);
+        for (int j = 0; j < 100; ++j)
+        {
+            clock.advance(1ms);
+            lo.main_task();
+            fh.main_task();
+        }
+    }
+    for (int j = 0; j < 5000 && received < 30; ++j)
+    {
+        clock.advance(1ms);
+        lo.main_task();
+        fh.main_task();
+    }
+    EXPECT_EQ(received, 30);
+    EXPECT_GT(fh.peer_loss_rate(2), fc.fec_loss_threshold);
+    EXPECT_GE(fh.fec_block(2), 2);
+    EXPECT_LE(fh.fec_block(2), fc.fec_max_block);
+}
+
+TEST(Fragmentation, StreamingDelivery)
+{
+    sp::manual_clock clock;
+    auto config = sim::channel::with_ber(0.001);
+    sim::channel ch(config, 5);
+    sp::loopback_interface lo(0, 1, 255, 10, 64, 1024, std::ref(ch));
+    auto fc = test_fragmentation_handler::configuration(lo);
+    fc.fec_block = 4;
+    fc.stream_threshold = lo.max_data_size() * 4;
+    test_fragmentation_handler fh(lo, lo.minimum_prealloc(), fc);
+    fh.bind_to(lo);
+
+    /* the large transfers come in pieces, in order and without gaps, the small ones as a whole */
+    std::srand(5);
+    std::map<sp::transfer::id_type, sp::bytes> expected, streamed;
+    uint received = 0, completed = 0;
+    fh.transfer_receive_event.subscribe([&](sp::transfer t){
+        EXPECT_TRUE(expected.at(t.get_id()) == t.data());
+        EXPECT_LT(t.data().size(), fc.stream_threshold);
+        ++received;
+    });
+    fh.transfer_chunk_event.subscribe([&](sp::transfer_chunk c){
+        auto & s = streamed[c.get_id()];
+        EXPECT_EQ(c.offset(), s.size());
+        EXPECT_EQ(c.transfer_size(), expected.at(c.get_id()).size());
+        s.push_back(c.data());
+        if (c.is_last())
+        {
+            EXPECT_TRUE(expected.at(c.get_id()) == s);
+            ++completed;
+        }
+    });
+    for (int i = 0; i < 20; ++i)
+    {
+        sp::transfer t(lo.interface_id(), 2);
+        t.data() = i % 2 ? random_bytes(10, lo.max_data_size() * 2) : random_bytes(lo.max_data_size() * 5, lo.max_data_size() * 15);
+        expected[t.get_id()] = t.data();
+        fh.transmit(t);
+        for (int j = 0; j < 100; ++j)
+        {
+            clock.advance(1ms);
+            lo.main_task();
+            fh.main_task();
+        }
+    }
+    for (int j = 0; j < 5000 && received + completed < 20; ++j)
+    {
+        clock.advance(1ms);
+        lo.main_task();
+        fh.main_task();
+    }
+    EXPECT_EQ(received, 10);
+    EXPECT_EQ(completed, 10);
+}
+
+TEST(Fragmentation, TransferChecksum)
+{
+    using th = sp::detail::transfer_handler<sp::headers::fragment_8b8b>;
+    using header_type = th::header_type;
+    using types = header_type::message_types;
+    sp::interface_identifier iid(sp::interface_identifier::VIRTUAL, 0);
+
+    /* the checksum of the pieces combines into the checksum of the whole */
+    auto b = random_bytes(100);
+    auto whole = sp::transfer_checksum::compute(b.begin(), b.end());
+    auto first = sp::transfer_checksum::compute(b.begin(), b.begin() + 37);
+    auto second = sp::transfer_checksum::compute(b.begin() + 37, b.end());
+    EXPECT_EQ(sp::transfer_checksum(63).combine(first, second), whole);
+
+    /* the trailer of 4 bytes is split between the last two fragments */
+    sp::transfer t(iid, 2);
+    t.data() = random_bytes(45);
+    const auto original = t.data();
+    th tx(std::move(t), 10, true);
+    EXPECT_EQ(tx.get_fragments_total(), 6);
+    std::map<uint, sp::fragment> sent;
+    auto take = [&](){
+        auto f = tx.get_next_fragment(10, sp::prealloc_size());
+        if (!f)
+            return 0u;
+        auto h = sp::parsers::byte_copy<header_type>(f->data().begin());
+        EXPECT_EQ(h.type(), types::FRAGMENT_CHECKED);
+        f->data().shrink(sizeof(header_type), 0);
+        sent.insert_or_assign(h.fragment(), std::move(*f));
+        return uint(h.fragment());
+    };
+    while (take() != 0);
+    ASSERT_EQ(sent.size(), 6);
+    auto header = [&](uint pos){
+        return header_type(types::FRAGMENT_CHECKED, pos, 6, tx.get_id(), 0, 0);
+    };
+    auto corrupt = [](sp::fragment f){
+        f.data()[0] ^= 0x40;
+        return f;
+    };
+    auto response = [](th & rx){
+        auto f = rx.get_response_fragment(sp::prealloc_size());
+        return f ? sp::parsers::byte_copy<header_type>(f->data().begin()) : header_type();
+    };
+
+    /* a fragment corrupted past the interface fails the checksum, the fragments are asked for again 
+    a block at a time until the retransmit of the corrupted one makes it match */
+    th rx(sent.at(1), header(1));
+    rx.set_resend_block(2);
+    for (uint pos = 2; pos <= 6; ++pos)
+        rx.put_fragment(pos, pos == 3 ? corrupt(sent.at(pos)) : sent.at(pos));
+    EXPECT_FALSE(rx.is_complete());
+    EXPECT_TRUE(rx.is_resending());
+    auto h = response(rx);
+    EXPECT_EQ(h.type(), types::FRAGMENT_RESEND);
+    EXPECT_EQ(h.fragment(), 1);
+    EXPECT_EQ(h.get_prev_id(), 2);
+
+    EXPECT_TRUE(tx.acknowledge(5));
+    EXPECT_EQ(tx.resend_request(h.fragment(), h.get_prev_id()), 2);
+    EXPECT_EQ(take(), 1);
+    EXPECT_EQ(take(), 2);
+    EXPECT_EQ(take(), 0);
+    rx.put_fragment(1, sent.at(1));
+    rx.put_fragment(2, sent.at(2));
+    h = response(rx);
+    EXPECT_EQ(h.type(), types::FRAGMENT_RESEND);
+    EXPECT_EQ(h.fragment(), 3);
+
+    EXPECT_EQ(tx.resend_request(h.fragment(), h.get_prev_id()), 2);
+    EXPECT_EQ(take(), 3);
+    rx.put_fragment(3, sent.at(3));
+    ASSERT_TRUE(rx.is_complete());
+    EXPECT_TRUE(rx.take_transfer().data() == original);
+    h = response(rx);
+    EXPECT_EQ(h.type(), types::FRAGMENT_ACK);
+    EXPECT_TRUE(tx.acknowledge(h.fragment()));
+    EXPECT_TRUE(tx.is_complete());
+
+    /* the corruption of the checksum itself cannot be told apart from the one of the data */
+    th rx2(sent.at(1), header(1));
+    for (uint pos = 2; pos <= 6; ++pos)
+        rx2.put_fragment(pos, pos == 6 ? corrupt(sent.at(pos)) : sent.at(pos));
+    EXPECT_EQ(response(rx2).get_prev_id(), 6);
+    for (uint pos = 1; pos <= 6; ++pos)
+        rx2.put_fragment(pos, pos == 6 ? corrupt(sent.at(pos)) : sent.at(pos));
+    EXPECT_TRUE(rx2.is_checksum_failed());
+    EXPECT_FALSE(rx2.is_complete());
+
+    /* the handlers carry the checksum end to end */
+    sp::manual_clock clock;
+    auto config = sim::channel::with_ber(0.001);
+    sim::channel ch(config, 4);
+    sp::loopback_interface lo(0, 1, 255, 10, 64, 1024, std::ref(ch));
+    auto fc = test_fragmentation_handler::configuration(lo);
+    fc.checksum_transfers = true;
+    test_fragmentation_handler fh(lo, lo.minimum_prealloc(), fc);
+    fh.bind_to(lo);
+    std::srand(4);
+    std::map<sp::transfer::id_type, sp::bytes> expected;
+    uint received = 0;
+    fh.transfer_receive_event.subscribe([&](sp::transfer t){
+        EXPECT_TRUE(expected.at(t.get_id()) == t.data());
+        ++received;
+    });
+    for (int i = 0; i < 10; ++i)
+    {
+        sp::transfer t(lo.interface_id(), 2);
+        t.data() = random_bytes(1, lo.max_data_size() * 10);
+        expected[t.get_id()] = t.data();
+        fh.transmit(t);
+    }
+    for (int j = 0; j < 5000 && received < 10; ++j)
+    {
+        clock.advance(1ms);
+        lo.main_task();
+        fh.main_task();
+    }
+    EXPECT_EQ(received, 10);
+}
+
+TEST(Fragmentation, WideHeader)
+{
+    using header_type = sp::headers::fragment_16b16b;
+    sp::manual_clock clock;
+    sp::loopback_interface lo(0, 1, 255, 10, 64, 1024);
+    sp::paced_fragmentation_handler_16b16b::configuration config(lo);
+    config.initial_rate = config.max_rate;
+    config.window_size = 64;
+    sp::paced_fragmentation_handler_16b16b fh(lo, lo.minimum_prealloc(), config);
+    fh.bind_to(lo);
+
+    /* the IDs of the interface no longer wrap at 255 */
+    sp::transfer::id_type max_id = 0;
+    for (int i = 0; i < 300; ++i)
+        max_id = std::max(max_id, sp::transfer(lo.interface_id(), 2).get_id());
+    EXPECT_GT(max_id, 255);
+
+    /* more than 255 fragments in a single transfer */
+    sp::transfer t(lo.interface_id(), 2);
+    t.data() = random_bytes(20000);
+    EXPECT_GT(t.data().size() / (lo.max_data_size() - sizeof(header_type)), 255);
+    
+    std::optional<sp::transfer> received;
+    fh.transfer_receive_event.subscribe([&](sp::transfer r){received = std::move(r);});
+    std::optional<sp::fragmentation_handler::transmit_status> status;
+    fh.transmit_complete_event.subscribe([&](sp::object_id_type, sp::fragmentation_handler::transmit_status s){
+        status = s;
+    });
+    fh.transmit(t);
+    for (int i = 0; i < 10000 && !status; ++i)
+    {
+        clock.advance(1ms);
+        fh.main_task();
+        lo.main_task();
+    }
+    ASSERT_TRUE(received);
+    EXPECT_TRUE(received->data() == t.data());
+    EXPECT_EQ(received->get_id(), t.get_id());
+    EXPECT_EQ(status, sp::fragmentation_handler::transmit_status::DONE);
+}
+
+TEST(Fragmentation, CompletedCache)
+{
+    using header_type = test_fragmentation_handler::header_type;
+    using types = header_type::message_types;
+    using th = sp::detail::transfer_handler<header_type>;
+    sp::manual_clock clock;
+
+    /* the ring forgets the oldest entries first, the entries expire */
+    sp::interface_identifier iid(sp::interface_identifier::VIRTUAL, 0);
+    sp::completed_transfer_cache cache(2);
+    auto key = [&](uint id){return sp::transfer_key{iid, 2, id, true};};
+    auto now = sp::clock::now();
+    cache.insert(key(1), 1, 3, 0, now + 1s);
+    cache.insert(key(2), 1, 3, 0, now + 1s);
+    cache.insert(key(3), 1, 3, 0, now + 1s);
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_EQ(cache.find(key(1), now), nullptr);
+    ASSERT_NE(cache.find(key(2), now), nullptr);
+    EXPECT_EQ(cache.find(key(2), now)->fragments_total, 3);
+    EXPECT_EQ(cache.find(key(3), now + 2s), nullptr);
+    uint responses = 0;
+    cache.take_responses([&](const sp::completed_transfer_cache::entry &){++responses;});
+    EXPECT_EQ(responses, 1);
+
+    /* the handler acknowledges the retransmits of a delivered transfer without delivering it again */
+    sp::virtual_interface vi(0, 1, 255, 10, 64, 256);
+    test_fragmentation_handler fh(vi);
+    std::vector<header_type> sent;
+    fh.transmit_event.subscribe([&](sp::fragment f){
+        EXPECT_EQ(f.destination(), 2);
+        sent.push_back(sp::parsers::byte_copy<header_type>(f.data().begin()));
+    });
+    uint delivered = 0;
+    fh.transfer_receive_event.subscribe([&](sp::transfer){++delivered;});
+
+    auto receive = [&](uint prev_id){
+        auto d = sp::to_bytes(header_type(types::FRAGMENT, 1, 1, 10, prev_id, 0));
+        d.push_back(sp::to_bytes(static_cast<th::length_type>(5)));
+        d.push_back(random_bytes(5));
+        fh.receive_callback(sp::fragment(2, 1, std::move(d), vi.interface_id()));
+        fh.main_task();
+    };
+    for (int i = 0; i < 3; ++i)
+    {
+        receive(0);
+        clock.advance(10ms);
+    }
+    EXPECT_EQ(delivered, 1);
+    ASSERT_EQ(sent.size(), 3);
+    for (const auto & h : sent)
+    {
+        EXPECT_EQ(h.type(), types::FRAGMENT_ACK);
+        EXPECT_EQ(h.fragment(), 1);
+        EXPECT_EQ(h.get_id(), 10);
+    }
+
+    /* once the peer would have given up retransmitting, the same ID is a new transfer */
+    clock.advance(fh.retransmit_timeout(2) * 64);
+    fh.main_task();
+    receive(0);
+    EXPECT_EQ(delivered, 2);
+
+    /* a peer that reused the ID sooner is told apart by the rest of the Header */
+    receive(7);
+    EXPECT_EQ(delivered, 3);
+    receive(7);
+    EXPECT_EQ(delivered, 3);
+}
+
+TEST(Fragmentation, WeightedFairQueue)
+{
+    /* two flows that are always ready share the link by their weights */
+    sp::detail::transfer_scheduler scheduler({1, 4, 16, 64});
+    scheduler.add(0, 2, 0);
+    scheduler.add(1, 3, 1);
+    std::array<uint, 2> served = {0, 0};
+    auto ready = [](std::size_t){return true;};
+    auto score = [](std::size_t){return 0;};
+    for (int i = 0; i < 50; ++i)
+    {
+        auto slot = scheduler.select(ready, score);
+        ASSERT_TRUE(slot);
+        ++served.at(*slot);
+        scheduler.charge(*slot, 10);
+    }
+    EXPECT_EQ(served[0], 10);
+    EXPECT_EQ(served[1], 40);
+
+    /* a flow held back by its peer does not block the others */
+    EXPECT_EQ(scheduler.select([](std::size_t s){return s == 0;}, score), 0);
+    scheduler.remove(0);
+    EXPECT_EQ(scheduler.select(ready, score), 1);
+    scheduler.remove(1);
+    EXPECT_TRUE(scheduler.empty());
+
+    /* a control transfer goes out in between the fragments of bulk data */
+    using header_type = test_fragmentation_handler::header_type;
+    sp::virtual_interface vi(0, 1, 255, 10, 64, 256);
+    test_fragmentation_handler fh(vi);
+    std::vector<header_type> sent;
+    fh.transmit_event.subscribe([&](sp::fragment f){
+        sent.push_back(sp::parsers::byte_copy<header_type>(f.data().begin()));
+    });
+
+    sp::transfer bulk(vi.interface_id(), 2), control(vi.interface_id(), 2);
+    bulk.data() = random_bytes(vi.max_data_size() * 6);
+    bulk.set_priority(0);
+    control.data() = random_bytes(10);
+    control.set_priority(sp::transfer::priority_classes - 1);
+    fh.transmit(bulk);
+    fh.main_task();
+    fh.transmit(control);
+    for (int i = 0; i < 3; ++i)
+        fh.main_task();
+    ASSERT_EQ(sent.size(), 4);
+    EXPECT_EQ(sent.at(0).get_id(), bulk.get_id());
+    EXPECT_EQ(sent.at(1).get_id(), control.get_id());
+
+    /* the priority class follows the transfer into its response */
+    EXPECT_EQ(control.create_response_transfer().get_priority(), sp::transfer::priority_classes - 1);
+}
+
+TEST(Fragmentation, TransferTable)
+{
+    using th = sp::detail::transfer_handler<sp::headers::fragment_8b8b>;
+    sp::detail::transfer_table<th> table;
+    sp::interface_identifier iid(sp::interface_identifier::VIRTUAL, 0);
 
+    auto make = [&](uint dst){
+        sp::transfer t(iid, dst);
+        t.data() = random_bytes(100);
+        return table.emplace(std::move(t), 10);
+    };
+    auto a = make(2), b = make(3);
+    sp::transfer_key ka{iid, 2, a->get_id(), false}, kb{iid, 3, b->get_id(), false};
+    EXPECT_EQ(table.size(), 2);
+    EXPECT_TRUE(table.find(ka) == a);
+    EXPECT_TRUE(table.find(kb) == b);
+    EXPECT_TRUE(table.find(sp::transfer_key{iid, 2, a->get_id(), true}) == table.end());
+
+    /* transmitted fragments are found by their object ID until they are reported as transmitted */
+    auto f = a->get_next_fragment(8, sp::prealloc_size());
+    ASSERT_TRUE(f);
+    table.update_fragment_index(a);
+    EXPECT_TRUE(table.find_transmitted(f->object_id()) == a);
+
+    /* erased slots are reused, the indexes forget the erased transfer */
+    table.erase(a);
+    EXPECT_EQ(table.size(), 1);
+    EXPECT_TRUE(table.find(ka) == table.end());
+    EXPECT_TRUE(table.find_transmitted(f->object_id()) == table.end());
+    auto c = make(4);
+    EXPECT_EQ(c.index(), 0);
+    EXPECT_EQ(std::distance(table.begin(), table.end()), 2);
+
+    /* growing the pool leaves the handlers where they are, the transmitted fragments keep
+    mapping to the transfers of the same object IDs */
+    std::vector<std::pair<sp::object_id_type, sp::object_id_type>> sent;
+    for (uint dst = 5; dst < 100; ++dst)
+    {
+        auto t = make(dst);
+        auto f = t->get_next_fragment(8, sp::prealloc_size());
+        ASSERT_TRUE(f);
+        table.update_fragment_index(t);
+        sent.emplace_back(f->object_id(), t->object_id());
+    }
+    for (const auto & [fragment, transfer] : sent)
+    {
+        auto t = table.find_transmitted(fragment);
+        ASSERT_TRUE(t != table.end());
+        EXPECT_EQ(t->object_id(), transfer);
+    }
+
+    /* the transfers are found by their peer as well */
+    auto with_peer = [&](uint peer, bool incoming){
+        uint count = 0;
+        table.for_each_with_peer(iid, peer, incoming, [&](auto itr){
+            EXPECT_EQ(itr->destination(), peer);
+            ++count;
+        });
+        return count;
+    };
+    make(3);
+    EXPECT_EQ(with_peer(3, false), 2);
+    EXPECT_EQ(with_peer(3, true), 0);
+    EXPECT_EQ(with_peer(2, false), 0);
+    table.erase(b);
+    EXPECT_EQ(with_peer(3, false), 1);
+}
+
+TEST(Fragmentation, SlidingWindow)
+{
+    using header_type = test_fragmentation_handler::header_type;
+    using types = header_type::message_types;
+    sp::manual_clock clock;
+
+    sp::virtual_interface vi(0, 1, 255, 10, 64, 256);
+    test_fragmentation_handler fh(vi);
+    std::vector<header_type> sent;
+    fh.transmit_event.subscribe([&](sp::fragment f){
+        sent.push_back(sp::parsers::byte_copy<header_type>(f.data().begin()));
+    });
+    auto respond = [&](types type, uint pos, uint total, uint id){
+        header_type h(type, pos, total, id, 0, 0);
+        fh.receive_callback(sp::fragment(2, 1, sp::to_bytes(h), vi.interface_id()));
+    };
+
+    sp::transfer t(vi.interface_id(), 2);
+    t.data() = random_bytes(vi.max_data_size() * 12);
+    auto id = t.get_id();
+    fh.transmit(t);
+
+    /* the whole window goes out without waiting for any response */
+    for (int i = 0; i < 20; ++i)
+        fh.main_task();
+    ASSERT_EQ(sent.size(), 8);
+    EXPECT_EQ(sent.back().fragment(), 8);
+    auto total = sent.back().fragments_total();
+
+    /* fragment 4 got lost, the peer acknowledges 1 to 3 and requests 4, the window moves */
+    respond(types::FRAGMENT_REQ, 4, total, id);
+    for (int i = 0; i < 20; ++i)
+        fh.main_task();
+    ASSERT_EQ(sent.size(), 12);
+    EXPECT_EQ(sent.at(8).fragment(), 4);
+    EXPECT_EQ(sent.at(9).fragment(), 9);
+    EXPECT_EQ(sent.at(11).fragment(), 11);
+
+    /* silence, the oldest unacknowledged fragment is retransmitted */
+    clock.advance(100ms);
+    fh.main_task();
+    ASSERT_EQ(sent.size(), 13);
+    EXPECT_EQ(sent.back().fragment(), 4);
+
+    bool done = false;
+    fh.transmit_complete_event.subscribe([&](sp::object_id_type, sp::fragmentation_handler::transmit_status s){
+        done = s == sp::fragmentation_handler::transmit_status::DONE;
+    });
+    respond(types::FRAGMENT_ACK, 11, total, id);
+    for (int i = 0; i < 20; ++i)
+        fh.main_task();
+    EXPECT_EQ(sent.back().fragment(), total);
+    respond(types::FRAGMENT_ACK, total, total, id);
+    EXPECT_TRUE(done);
+}
+
+TEST(Fragmentation, SelectiveNack)
+{
+    using header_type = test_fragmentation_handler::header_type;
+    using types = header_type::message_types;
+    using th = sp::detail::transfer_handler<header_type>;
+    sp::manual_clock clock;
+
+    /* the receiver reports all the gaps at once */
+    sp::interface_identifier iid(sp::interface_identifier::NONE, 0);
+    auto data_fragment = [&](uint pos){
+        if (pos == 1)
+            return sp::fragment(2, 1, sp::to_bytes(static_cast<th::length_type>(53 - th::length_size)) + 
+                random_bytes(10 - th::length_size), iid);
+        return sp::fragment(2, 1, random_bytes(pos == 6 ? 3 : 10), iid);
+    };
+    th rx(data_fragment(1), header_type(types::FRAGMENT, 1, 6, 10, 0, 0));
+    rx.put_fragment(3, data_fragment(3));
+    rx.put_fragment(5, data_fragment(5));
+    EXPECT_EQ(rx.first_missing(), 2);
+    EXPECT_EQ(rx.highest_received(), 5);
+    EXPECT_EQ(rx.get_received_count(), 3);
+    auto nack = rx.get_response_fragment(sp::prealloc_size());
+    ASSERT_TRUE(nack);
+    auto nh = sp::parsers::byte_copy<header_type>(nack->data().begin());
+    EXPECT_EQ(nh.type(), types::FRAGMENT_NACK);
+    EXPECT_EQ(nh.fragment(), 2);
+    ASSERT_EQ(nack->data().size(), sizeof(header_type) + 1);
+    EXPECT_EQ(nack->data()[sizeof(header_type)], 0b1010);
+    for (uint pos : {2, 4, 6})
+        rx.put_fragment(pos, data_fragment(pos));
+    EXPECT_TRUE(rx.is_complete());
+    EXPECT_EQ(sp::parsers::byte_copy<header_type>(rx.get_response_fragment(sp::prealloc_size())->data().begin()).type(), 
+        types::FRAGMENT_ACK);
+
+    /* and the sender retransmits them in one go */
+    sp::virtual_interface vi(0, 1, 255, 10, 64, 256);
+    test_fragmentation_handler fh(vi);
+    std::vector<header_type> sent;
+    fh.transmit_event.subscribe([&](sp::fragment f){
+        sent.push_back(sp::parsers::byte_copy<header_type>(f.data().begin()));
+    });
+
+    sp::transfer t(vi.interface_id(), 2);
+    t.data() = random_bytes(vi.max_data_size() * 12);
+    auto id = t.get_id();
+    fh.transmit(t);
+    for (int i = 0; i < 20; ++i)
+        fh.main_task();
+    ASSERT_EQ(sent.size(), 8);
+    auto total = sent.back().fragments_total();
+
+    /* 2 and 4 are missing, 3, 5 and 6 were received */
+    auto send_nack = [&](){
+        auto data = sp::to_bytes(header_type(types::FRAGMENT_NACK, 2, total, id, 0, 0));
+        data.push_back(0b11010);
+        fh.receive_callback(sp::fragment(2, 1, std::move(data), vi.interface_id()));
+        for (int i = 0; i < 20; ++i)
+            fh.main_task();
+    };
+    send_nack();
+    ASSERT_EQ(sent.size(), 11);
+    EXPECT_EQ(sent.at(8).fragment(), 2);
+    EXPECT_EQ(sent.at(9).fragment(), 4);
+    EXPECT_EQ(sent.at(10).fragment(), 9);
+
+    /* the same NACK again does not cause another round of retransmits */
+    send_nack();
+    EXPECT_EQ(sent.size(), 11);
+}
+
+TEST(Fragmentation, CoalescedAcks)
+{
+    using header_type = test_fragmentation_handler::header_type;
+    using types = header_type::message_types;
+    using th = sp::detail::transfer_handler<header_type>;
+    sp::manual_clock clock;
+
+    sp::virtual_interface vi(0, 1, 255, 10, 64, 256);
+    test_fragmentation_handler fh(vi);
+    std::vector<sp::fragment> sent;
+    fh.transmit_event.subscribe([&](sp::fragment f){
+        sent.push_back(std::move(f));
+    });
+    uint received = 0, done = 0;
+    fh.transfer_receive_event.subscribe([&](sp::transfer){++received;});
+    fh.transmit_complete_event.subscribe([&](sp::object_id_type, sp::fragmentation_handler::transmit_status s){
+        if (s == sp::fragmentation_handler::transmit_status::DONE) ++done;
+    });
+    auto headers_of = [](const sp::fragment & f){
+        std::vector<header_type> ret;
+        auto d = f.data();
+        while (d.size() >= sizeof(header_type))
+        {
+            ret.push_back(sp::parsers::byte_copy<header_type>(d.begin()));
+            d.shrink(sizeof(header_type), 0);
+            if (ret.back().type() != types::FRAGMENT_ACK)
+                break;
+        }
+        return ret;
+    };
+    auto receive = [&](header_type h, sp::bytes data){
+        fh.receive_callback(sp::fragment(2, 1, sp::to_bytes(h) + data, vi.interface_id()));
+    };
+    auto single_fragment = [&](sp::transfer::id_type id){
+        receive(header_type(types::FRAGMENT, 1, 1, id, 0, 0), sp::to_bytes(static_cast<th::length_type>(5)) + random_bytes(5));
+    };
+
+    /* the final ACKs of two transfers delivered in the same period go out in one fragment */
+    single_fragment(10);
+    single_fragment(11);
+    fh.main_task();
+    EXPECT_EQ(received, 2);
+    ASSERT_EQ(sent.size(), 1);
+    auto acks = headers_of(sent.at(0));
+    ASSERT_EQ(acks.size(), 2);
+    EXPECT_EQ(acks.at(0).type(), types::FRAGMENT_ACK);
+    EXPECT_EQ(acks.at(1).type(), types::FRAGMENT_ACK);
+    EXPECT_EQ(acks.at(0).get_id() + acks.at(1).get_id(), 10 + 11);
+    EXPECT_EQ(sent.at(0).data().size(), 2 * sizeof(header_type));
+
+    /* the ACK of an incomplete transfer waits for a while */
+    auto fragment_size = vi.max_data_size() - sizeof(header_type);
+    receive(header_type(types::FRAGMENT, 1, 3, 20, 0, 0), 
+        sp::to_bytes(static_cast<th::length_type>(fragment_size * 3 - th::length_size)) + random_bytes(fragment_size - th::length_size));
+    fh.main_task();
+    EXPECT_EQ(sent.size(), 1);
+
+    /* and rides along with the first data fragment to the peer */
+    sp::transfer t(vi.interface_id(), 2);
+    t.data() = random_bytes(10);
+    auto id = t.get_id();
+    fh.transmit(t);
+    fh.main_task();
+    ASSERT_EQ(sent.size(), 2);
+    auto piggyback = headers_of(sent.at(1));
+    ASSERT_EQ(piggyback.size(), 2);
+    EXPECT_EQ(piggyback.at(0).type(), types::FRAGMENT_ACK);
+    EXPECT_EQ(piggyback.at(0).get_id(), 20);
+    EXPECT_EQ(piggyback.at(0).fragment(), 1);
+    EXPECT_EQ(piggyback.at(1).type(), types::FRAGMENT);
+    EXPECT_EQ(piggyback.at(1).get_id(), id);
+    EXPECT_EQ(sent.at(1).data().size(), 2 * sizeof(header_type) + th::length_size + 10);
+
+    /* the peer does the same, its ACK is followed by the fragment of a new transfer */
+    fh.receive_callback(sp::fragment(2, 1, sp::to_bytes(header_type(types::FRAGMENT_ACK, 1, 1, id, 0, 0)) + 
+        sp::to_bytes(header_type(types::FRAGMENT, 1, 1, 12, 0, 0)) + sp::to_bytes(static_cast<th::length_type>(5)) + random_bytes(5), 
+        vi.interface_id()));
+    EXPECT_EQ(done, 1);
+    EXPECT_EQ(received, 3);
+
+    /* the final ACK does not wait */
+    fh.main_task();
+    ASSERT_EQ(sent.size(), 3);
+    auto final_ack = headers_of(sent.at(2));
+    ASSERT_EQ(final_ack.size(), 1);
+    EXPECT_EQ(final_ack.at(0).get_id(), 12);
+
+    /* without anything to carry it the delayed ACK goes out on its own */
+    receive(header_type(types::FRAGMENT, 2, 3, 20, 0, 0), random_bytes(fragment_size));
+    fh.main_task();
+    EXPECT_EQ(sent.size(), 3);
+    clock.advance(5ms);
+    fh.main_task();
+    ASSERT_EQ(sent.size(), 4);
+    auto late = headers_of(sent.at(3));
+    ASSERT_EQ(late.size(), 1);
+    EXPECT_EQ(late.at(0).type(), types::FRAGMENT_ACK);
+    EXPECT_EQ(late.at(0).fragment(), 2);
+}
+
+TEST(Fragmentation, TransferBudget)
+{
+    using header_type = test_fragmentation_handler::header_type;
+    using types = header_type::message_types;
+    using th = sp::detail::transfer_handler<header_type>;
+    using policy = test_fragmentation_handler::admission_policy;
+    using status = sp::fragmentation_handler::transmit_status;
+    sp::manual_clock clock;
+
+    /* the incoming transfers beyond the budget are turned away and the peers told to back off, 
+    the stalled ones make room with EVICT_STALLED */
+    sp::virtual_interface vi(0, 1, 255, 10, 64, 256);
+    auto config = test_fragmentation_handler::configuration(vi);
+    config.incoming_budget.count = 2;
+    config.stall_time = 10ms;
+    test_fragmentation_handler rx(vi, vi.minimum_prealloc(), config);
+    auto fragment_size = vi.max_data_size() - sizeof(header_type);
+    auto first_fragment = [&](test_fragmentation_handler & fh, sp::transfer::id_type id){
+        auto h = header_type(types::FRAGMENT, 1, 3, id, 0, 0);
+        fh.receive_callback(sp::fragment(2, 1, sp::to_bytes(h) + sp::to_bytes(static_cast<th::length_type>(fragment_size * 3 - th::length_size)) + 
+            random_bytes(fragment_size - th::length_size), vi.interface_id()));
+    };
+    for (sp::transfer::id_type id = 10; id < 13; ++id)
+        first_fragment(rx, id);
+    EXPECT_EQ(rx.get_budget_usage(true).count, 2);
+    EXPECT_EQ(rx.get_budget_usage(true).size, fragment_size * 3 * 2);
+    EXPECT_TRUE(rx.our_status().rx_critical());
+    clock.advance(20ms);
+    first_fragment(rx, 13);
+    EXPECT_EQ(rx.get_budget_usage(true).count, 2);
+
+    config.incoming_budget.policy = policy::EVICT_STALLED;
+    test_fragmentation_handler rx2(vi, vi.minimum_prealloc(), config);
+    first_fragment(rx2, 10);
+    first_fragment(rx2, 11);
+    first_fragment(rx2, 12);
+    EXPECT_EQ(rx2.get_budget_usage(true).count, 2);
+    EXPECT_TRUE(rx2.our_status().rx_critical());
+    clock.advance(20ms);
+    first_fragment(rx2, 12);
+    EXPECT_EQ(rx2.get_budget_usage(true).count, 2);
+    EXPECT_FALSE(rx2.our_status().rx_critical());
+
+    /* the outgoing transfers report BUSY, or wait with DEFER */
+    sp::loopback_interface lo(0, 1, 255, 10, 64, 1024);
+    auto lc = test_fragmentation_handler::configuration(lo);
+    lc.outgoing_budget.count = 2;
+    lc.outgoing_budget.policy = policy::DEFER;
+    test_fragmentation_handler fh(lo, lo.minimum_prealloc(), lc);
+    fh.bind_to(lo);
+    uint received = 0, done = 0, busy = 0;
+    fh.transfer_receive_event.subscribe([&](sp::transfer){++received;});
+    fh.transmit_complete_event.subscribe([&](sp::object_id_type, status s){
+        if (s == status::DONE) ++done;
+        if (s == status::BUSY) ++busy;
+    });
+    for (int i = 0; i < 5; ++i)
+    {
+        sp::transfer t(lo.interface_id(), 2);
+        t.data() = random_bytes(lo.max_data_size() * 3);
+        fh.transmit(t);
+    }
+    fh.main_task();
+    EXPECT_EQ(busy, 1);
+    EXPECT_EQ(fh.get_deferred_count(), 2);
+    EXPECT_EQ(fh.get_budget_usage(false).count, 2);
+    for (int j = 0; j < 1000 && done < 4; ++j)
+    {
+        clock.advance(1ms);
+        lo.main_task();
+        fh.main_task();
+        EXPECT_LE(fh.get_budget_usage(false).count, 2);
+    }
+    EXPECT_EQ(done, 4);
+    EXPECT_EQ(received, 4);
+    EXPECT_EQ(fh.get_deferred_count(), 0);
+    EXPECT_EQ(fh.get_budget_usage(false).count, 0);
+    EXPECT_EQ(fh.get_budget_usage(false).size, 0);
+
+    /* the deferred transfers start in order, a small one which would fit does not overtake a large one */
+    auto lo_fragment_size = lo.max_data_size() - sizeof(header_type);
+    lc.outgoing_budget.count = 0;
+    lc.outgoing_budget.size = lo_fragment_size * 4;
+    test_fragmentation_handler ordered(lo, lo.minimum_prealloc(), lc);
+    ordered.bind_to(lo);
+    std::vector<sp::bytes::size_type> order;
+    ordered.transfer_receive_event.subscribe([&](sp::transfer t){order.push_back(t.data().size());});
+    /* 3, 2 and 1 fragments, the second one does not fit next to the first, the third would */
+    for (auto size : {static_cast<uint>(lo_fragment_size * 2), static_cast<uint>(lo_fragment_size), 10u})
+    {
+        sp::transfer t(lo.interface_id(), 2);
+        t.data() = random_bytes(size);
+        ordered.transmit(t);
+    }
+    EXPECT_EQ(ordered.get_deferred_count(), 2);
+    for (int j = 0; j < 1000 && order.size() < 3; ++j)
+    {
+        clock.advance(1ms);
+        lo.main_task();
+        ordered.main_task();
+    }
+    EXPECT_EQ(order, (std::vector<sp::bytes::size_type>{lo_fragment_size * 2, lo_fragment_size, 10}));
+}
+
+TEST(Fragmentation, Pacing)
+{
+    using header_type = sp::paced_fragmentation_handler::header_type;
+    using types = header_type::message_types;
+    sp::manual_clock clock;
+
+    sp::virtual_interface vi(0, 1, 255, 10, 64, 256);
+    sp::paced_fragmentation_handler::configuration config(vi);
+    /* 640 B/s, that is 10 fragments per second */
+    config.initial_rate = 5120;
+    config.rate_increase = 1000;
+    config.window_size = 255;
+    sp::paced_fragmentation_handler fh(vi, vi.minimum_prealloc(), config);
+    uint sent = 0;
+    fh.transmit_event.subscribe([&](sp::fragment){++sent;});
+    auto respond = [&](types type, uint pos, uint total, uint id, sp::bytes data = sp::bytes()){
+        auto d = sp::to_bytes(header_type(type, pos, total, id, 0, 0));
+        d.push_back(data);
+        fh.receive_callback(sp::fragment(2, 1, std::move(d), vi.interface_id()));
+    };
+
+    sp::transfer t(vi.interface_id(), 2);
+    t.data() = random_bytes(vi.max_data_size() * 20);
+    auto id = t.get_id();
+    fh.transmit(t);
+    uint total = 0;
+    fh.transmit_event.subscribe([&](sp::fragment f){
+        total = sp::parsers::byte_copy<header_type>(f.data().begin()).fragments_total();
+    });
+
+    /* the burst of two fragments, then one every 100 ms */
+    for (int i = 0; i < 500; ++i)
+    {
+        clock.advance(1ms);
+        fh.main_task();
+    }
+    EXPECT_GE(sent, 6);
+    EXPECT_LE(sent, 8);
+
+    /* slow start doubles the rate every round trip */
+    respond(types::FRAGMENT_ACK, 2, total, id);
+    EXPECT_EQ(fh.peer_rate(2), 10240);
+
+    /* loss halves it and ends slow start */
+    clock.advance(600ms);
+    sp::bytes bitmap = {0b10};
+    respond(types::FRAGMENT_NACK, 3, total, id, bitmap);
+    EXPECT_EQ(fh.peer_rate(2), 5120);
+
+    /* from now on it grows linearly */
+    clock.advance(600ms);
+    respond(types::FRAGMENT_ACK, 4, total, id);
+    EXPECT_EQ(fh.peer_rate(2), 6120);
+
+    /* a NACK that acknowledges fragments and reports loss at the same time halves the rate */
+    sp::paced_fragmentation_handler lossy(vi, vi.minimum_prealloc(), config);
+    total = 0;
+    lossy.transmit_event.subscribe([&](sp::fragment f){
+        total = sp::parsers::byte_copy<header_type>(f.data().begin()).fragments_total();
+    });
+    sp::transfer t2(vi.interface_id(), 3);
+    t2.data() = random_bytes(vi.max_data_size() * 20);
+    auto id2 = t2.get_id();
+    lossy.transmit(t2);
+    for (int i = 0; i < 500; ++i)
+    {
+        clock.advance(1ms);
+        lossy.main_task();
+    }
+    auto respond_lossy = [&](types type, uint pos, sp::bytes data = sp::bytes()){
+        auto d = sp::to_bytes(header_type(type, pos, total, id2, 0, 0));
+        d.push_back(data);
+        lossy.receive_callback(sp::fragment(3, 1, std::move(d), vi.interface_id()));
+    };
+    respond_lossy(types::FRAGMENT_NACK, 4, bitmap);
+    EXPECT_EQ(lossy.peer_rate(3), 2560);
+
+    /* and ends slow start */
+    clock.advance(600ms);
+    respond_lossy(types::FRAGMENT_ACK, 5);
+    EXPECT_EQ(lossy.peer_rate(3), 3560);
+}
+
+TEST(Fragmentation, LossyDelivery)
+{
+    sp::manual_clock clock;
+    auto config = sim::channel::with_ber(0.0005);
+    config.drop_rate = 0.0005;
+    sim::channel ch(config, 8);
+    sp::loopback_interface lo(0, 1, 255, 10, 64, 1024, std::ref(ch));
+    test_fragmentation_handler fh(lo);
+    fh.bind_to(lo);
+    std::srand(8);
+
+    std::map<sp::transfer::id_type, sp::bytes> expected;
+    uint received = 0, done = 0;
+    fh.transfer_receive_event.subscribe([&](sp::transfer t){
+        EXPECT_TRUE(expected.at(t.get_id()) == t.data());
+        ++received;
+    });
+    fh.transmit_complete_event.subscribe([&](sp::object_id_type, sp::fragmentation_handler::transmit_status s){
+        if (s == sp::fragmentation_handler::transmit_status::DONE) ++done;
+    });
+
+    for (int i = 0; i < 50; ++i)
+    {
+        sp::transfer t(lo.interface_id(), 2);
+        t.data() = random_bytes(1, lo.max_data_size() * 10);
+        expected[t.get_id()] = t.data();
+        fh.transmit(t);
+        for (int j = 0; j < 100; ++j)
+        {
+            clock.advance(1ms);
+            lo.main_task();
+            fh.main_task();
+        }
+    }
+    /* let the late retransmits finish */
+    for (int j = 0; j < 5000 && done < 50; ++j)
+    {
+        clock.advance(1ms);
+        lo.main_task();
+        fh.main_task();
+    }
+    EXPECT_EQ(received, 50);
+    EXPECT_EQ(done, 50);
+    EXPECT_GT(ch.flipped_bits() + ch.dropped_bytes(), 0);
+
+    /* the loopback round trip is a few main_task periods, the timeout adapted to it */
+    ASSERT_NE(fh.peer_rtt(2), nullptr);
+    EXPECT_TRUE(fh.peer_rtt(2)->has_samples());
+    EXPECT_LT(fh.peer_rtt(2)->srtt(), 20ms);
+}
+
+TEST(Fragmentation, RttEstimator)
+{
+    sp::rtt_estimator e(1s, 10ms, 10s);
+    EXPECT_FALSE(e.has_samples());
+    EXPECT_EQ(e.rto(), 1s);
+    e.backoff();
+    EXPECT_EQ(e.rto(), 2s);
+
+    /* the first sample resets the backoff, srtt = rtt, rttvar = rtt / 2 */
+    e.sample(100ms);
+    EXPECT_EQ(e.srtt(), 100ms);
+    EXPECT_EQ(e.rttvar(), 50ms);
+    EXPECT_EQ(e.rto(), 300ms);
+
+    /* a stable link converges to srtt with a vanishing variance, down to min_rto */
+    for (int i = 0; i < 100; ++i)
+        e.sample(2ms);
+    EXPECT_LT(e.srtt(), 3ms);
+    EXPECT_EQ(e.rto(), 10ms);
+    EXPECT_EQ(e.give_up_time(2), 10ms + 20ms + 40ms);
+
+    for (int i = 0; i < 20; ++i)
+        e.backoff();
+    EXPECT_EQ(e.rto(), 10s);
+
+    /* the time the fragment waited in the interface queue is not a part of the round trip,
+    this holds with other subscribers of the transmit_event too */
+    using header_type = test_fragmentation_handler::header_type;
+    sp::manual_clock clock;
+    sp::virtual_interface vi(0, 1, 255, 10, 64, 256);
+    test_fragmentation_handler fh(vi);
+    fh.bind_to(vi);
+    uint total = 0;
+    fh.transmit_event.subscribe([&](sp::fragment f){
+        total = sp::parsers::byte_copy<header_type>(f.data().begin()).fragments_total();
+    });
+    sp::transfer t(vi.interface_id(), 2);
+    t.data() = random_bytes(vi.max_data_size() * 2);
+    auto id = t.get_id();
+    fh.transmit(t);
+    for (int i = 0; i < 5; ++i)
+        fh.main_task();
+    clock.advance(50ms);
+    for (int i = 0; i < 5; ++i)
+        vi.main_task();
+    fh.receive_callback(sp::fragment(2, 1, sp::to_bytes(header_type(header_type::FRAGMENT_ACK, total, total, id, 0, 0)),
+        vi.interface_id()));
+    ASSERT_NE(fh.peer_rtt(2), nullptr);
+    ASSERT_TRUE(fh.peer_rtt(2)->has_samples());
+    EXPECT_LT(fh.peer_rtt(2)->srtt(), 10ms);
+
+    /* the samples are not quantized to the main_task period */
+    using th = sp::detail::transfer_handler<header_type>;
+    auto now = sp::clock::now();
+    {
+        sp::clock_override precise([&]{return now;});
+        sp::transfer tt(vi.interface_id(), 2);
+        tt.data() = random_bytes(100);
+        th tx(std::move(tt), 10);
+        ASSERT_TRUE(tx.get_next_fragment(8, sp::prealloc_size()));
+        now += 3ms;
+        EXPECT_TRUE(tx.acknowledge(1));
+        auto sample = tx.take_rtt_sample();
+        ASSERT_TRUE(sample);
+        EXPECT_EQ(*sample, 3ms);
+    }
+}
 
 
 /*TEST(Fragmentation, UnalteredRandom)
@@ -794,6 +2311,102 @@ TEST(Ports, EchoService)
 }
 
 
+TEST(Ports, Compression)
+{
+    sp::lzss_compression lzss;
+    sp::prealloc_size alloc(3, 2);
+
+    /* telemetry like data shrinks, the room for the headers is kept */
+    std::string telemetry;
+    for (int i = 0; i < 20; ++i)
+        telemetry += "{\"temp\":" + std::to_string(20 + i % 3) + ",\"state\":\"idle\"}";
+    sp::bytes text(telemetry.size());
+    std::copy(telemetry.begin(), telemetry.end(), reinterpret_cast<char*>(text.data()));
+    auto compressed = lzss.compress(text, alloc);
+    ASSERT_TRUE(compressed);
+    EXPECT_LT(compressed->size(), text.size() / 4);
+    EXPECT_GE(compressed->capacity_front(), 3);
+    EXPECT_GE(compressed->capacity_back(), 2);
+    auto restored = lzss.decompress(*compressed, text.size());
+    ASSERT_TRUE(restored);
+    EXPECT_TRUE(*restored == text);
+
+    /* runs and data without any repetition */
+    sp::bytes run(1000);
+    run.set(7_BYTE);
+    auto compressed_run = lzss.compress(run, sp::prealloc_size());
+    ASSERT_TRUE(compressed_run);
+    EXPECT_TRUE(*lzss.decompress(*compressed_run, 1000) == run);
+    EXPECT_FALSE(lzss.compress(random_bytes(200), alloc));
+    EXPECT_FALSE(lzss.compress(sp::bytes(), alloc));
+
+    /* the decoder does not go over its limit and rejects malformed data */
+    EXPECT_FALSE(lzss.decompress(*compressed, text.size() - 1));
+    auto truncated = *compressed;
+    truncated.shrink(0, 1);
+    EXPECT_FALSE(lzss.decompress(truncated, text.size()));
+    auto bad_offset = sp::bytes({5_BYTE, 1_BYTE, 0xff_BYTE, 0x02_BYTE});
+    EXPECT_FALSE(lzss.decompress(bad_offset, 100));
+
+    /* the flag is covered by the check */
+    sp::headers::ports_8b plain_header(3, 4), packed_header(3, 4, sp::headers::ports_8b::COMPRESSED);
+    EXPECT_TRUE(sp::to_bytes(plain_header) == sp::bytes({3_BYTE, 4_BYTE, 0_BYTE, 7_BYTE}));
+    EXPECT_FALSE(plain_header.is_compressed());
+    EXPECT_TRUE(packed_header.is_valid());
+    EXPECT_TRUE(packed_header.is_compressed());
+    packed_header.flags = 0;
+    EXPECT_FALSE(packed_header.is_valid());
+
+    /* the ports_handler compresses the packets that ask for it */
+    sp::bytes raw_data;
+    sp::loopback_interface lo(0, 1, 255, 10, 64, 1024, [&](sp::byte b){
+        raw_data.push_back(b);
+        return b;
+    });
+    sp::manual_clock clock;
+    test_fragmentation_handler fh(lo);
+    fh.bind_to(lo);
+    sp::ports_handler ph;
+    ph.register_interface(fh);
+    ph.enable_compression(lzss);
+    sp::echo_service echo(ph, 1);
+    auto & p2 = ph.register_service(2);
+    std::vector<sp::packet> rx;
+    p2.receive_event.subscribe([&rx](sp::packet p){
+        rx.push_back(std::move(p));
+    });
+    
+    auto send = [&](bool compressible){
+        raw_data.clear();
+        sp::packet txp;
+        txp.set_destination(2);
+        txp.set_destination_port(1);
+        txp.set_interface_id(lo.interface_id());
+        txp.set_compressible(compressible);
+        txp.data() = text;
+        p2._transmit_callback(txp);
+        for (int i = 0; i < 200; ++i)
+        {
+            clock.advance(1ms);
+            fh.main_task();
+            lo.main_task();
+        }
+        return raw_data.size();
+    };
+    auto plain = send(false);
+    auto packed = send(true);
+    ASSERT_EQ(rx.size(), 2);
+    EXPECT_TRUE(rx.at(0).data() == text);
+    EXPECT_TRUE(rx.at(1).data() == text);
+    EXPECT_TRUE(rx.at(1).is_compressible());
+    EXPECT_LT(packed * 2, plain);
+
+    /* the data which would decompress over the limit is dropped */
+    ph.enable_compression(lzss, {.min_size = 32, .all_packets = true, .max_size = 100});
+    send(false);
+    EXPECT_EQ(rx.size(), 2);
+}
+
 class test_command : public sp::command_server::command_base
 {
     public: